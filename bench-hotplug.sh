@@ -0,0 +1,183 @@
+#!/bin/sh
+# Measure the delay between RANDR layout or Xft.dpi changes and the updated
+# scaling factors from xdpi-epoll, and the CPU time spent on each change,
+# on a private Xvfb server.
+#
+# Usage: ./bench-hotplug.sh [ROUNDS]
+#
+# Each round docks a monitor, resizes the screen, rotates the output,
+# changes Xft.dpi, and undocks, measuring each step from the start of the
+# xrandr or xrdb command to the last snapshot before xdpi-epoll goes quiet
+# for SETTLE_MS. The latency distribution and the mean CPU time of each step
+# are shown after ROUNDS rounds (default: 20), followed by a docking storm:
+# STORM monitor changes sent back to back, measured from the last one.
+# Steps that the server rejects (e.g. rotation on some Xvfb versions)
+# are reported as unsupported. Requires Xvfb, xrandr and xrdb.
+
+XDPI_EPOLL="${XDPI_EPOLL:-./xdpi-epoll}"
+DISPLAY_NUM="${DISPLAY_NUM:-97}"
+ROUNDS="${1:-20}"
+STORM="${STORM:-50}"
+SETTLE_MS="${SETTLE_MS:-200}"
+TIMEOUT_MS="${TIMEOUT_MS:-5000}"
+
+LOG="$(mktemp)"
+RESULTS="$(mktemp)"
+
+now_ms() {
+	date +%s%3N
+}
+
+cleanup() {
+	kill $EPOLL_PID $XVFB_PID 2>/dev/null
+	rm -f "$LOG" "$RESULTS"
+}
+trap cleanup EXIT
+
+Xvfb ":$DISPLAY_NUM" -screen 0 3840x2160x24 +extension RANDR -nolisten tcp 2>/dev/null &
+XVFB_PID=$!
+export DISPLAY=":$DISPLAY_NUM"
+
+i=0
+until xrandr >/dev/null 2>&1; do
+	i=$((i+1))
+	[ $i -gt 50 ] && { echo "Xvfb did not start" >&2; exit 1; }
+	sleep 0.1
+done
+
+echo "Xft.dpi: 96" | xrdb -merge
+
+"$XDPI_EPOLL" --snapshots --timestamps > "$LOG" 2>/dev/null &
+EPOLL_PID=$!
+
+# snapshots: number of snapshots logged so far
+snapshots() {
+	grep -c '^@' "$LOG"
+}
+
+# snapshot N: the wall clock and CPU time of the Nth snapshot
+snapshot() {
+	awk -v n="$1" '/^@/ && ++k == n { print substr($1, 2), $2; exit }' "$LOG"
+}
+
+# settle COUNT START: wait for a snapshot after the first COUNT, then for
+# SETTLE_MS without new ones; prints the number of the last snapshot,
+# or nothing if none came within TIMEOUT_MS of START
+settle() {
+	count="$1"
+	start="$2"
+	while [ "$(snapshots)" -le "$count" ]; do
+		kill -0 $EPOLL_PID 2>/dev/null || { echo "xdpi-epoll failed" >&2; exit 1; }
+		[ $(($(now_ms) - start)) -gt "$TIMEOUT_MS" ] && return
+		sleep 0.01
+	done
+	last=$(snapshots)
+	quiet=$(now_ms)
+	while [ $(($(now_ms) - quiet)) -lt "$SETTLE_MS" ]; do
+		sleep 0.01
+		n=$(snapshots)
+		[ "$n" -ne "$last" ] && { last=$n; quiet=$(now_ms); }
+	done
+	echo "$last"
+}
+
+until [ "$(snapshots)" -ge 1 ]; do
+	kill -0 $EPOLL_PID 2>/dev/null || { echo "xdpi-epoll failed" >&2; exit 1; }
+	sleep 0.1
+done
+settle 0 "$(now_ms)" >/dev/null
+
+# measure LABEL COMMAND...: run the command, and record the delay until the
+# last resulting snapshot, and the CPU time used by xdpi-epoll meanwhile
+measure() {
+	label="$1"
+	shift
+	count=$(snapshots)
+	before=$(snapshot "$count")
+	start=$(now_ms)
+	if ! "$@" >/dev/null 2>&1; then
+		printf '%s\tunsupported\n' "$label" >> "$RESULTS"
+		return
+	fi
+	last=$(settle "$count" "$start")
+	if [ -z "$last" ]; then
+		printf '%s\tnone\n' "$label" >> "$RESULTS"
+		return
+	fi
+	set -- $before $(snapshot "$last")
+	printf '%s\t%d\t%d\t%d\n' "$label" $(($3 - start)) $(($4 - $2)) \
+		$((last - count)) >> "$RESULTS"
+}
+
+merge_xft_dpi() {
+	echo "Xft.dpi: $1" | xrdb -merge
+}
+
+printf 'Running %d rounds' "$ROUNDS"
+round=0
+while [ $round -lt "$ROUNDS" ]; do
+	measure "dock monitor" xrandr --setmonitor DOCK-1 1920/510x1080/290+3840+0 none
+	measure "resize screen" xrandr --fb 5760x2160
+	measure "rotate output" xrandr --output screen --rotate left
+	measure "restore rotation" xrandr --output screen --rotate normal
+	measure "Xft.dpi change" merge_xft_dpi 144
+	measure "Xft.dpi restore" merge_xft_dpi 96
+	measure "undock monitor" xrandr --delmonitor DOCK-1
+	measure "restore size" xrandr --fb 3840x2160
+	round=$((round+1))
+	printf '.'
+done
+echo
+
+printf '\n%-18s %5s %7s %7s %7s %7s %7s %9s %6s\n' step n \
+	"min ms" "p50 ms" "p90 ms" "p99 ms" "max ms" "CPU us" snaps
+# Steps in the order they ran, then by latency
+awk -F '\t' '!($1 in order) { order[$1] = ++m } { print order[$1] "\t" $0 }' "$RESULTS" |
+	sort -t '	' -k1,1n -k3,3n | awk -F '\t' '
+function flush(  i) {
+	if (label == "")
+		return
+	if (!n) {
+		printf "%-18s %5s %s\n", label, "-", failed
+		return
+	}
+	printf "%-18s %5d %7d %7d %7d %7d %7d %9d %6.1f\n", label, n,
+		v[1], v[int((n+1)*0.5)], v[int(n*0.9+0.999)], v[int(n*0.99+0.999)],
+		v[n], cpu/n, snaps/n
+}
+$2 != label { flush(); label = $2; n = cpu = snaps = 0; failed = "" }
+$3 == "unsupported" || $3 == "none" {
+	failed = ($3 == "none") ? "no snapshot within timeout" : "not supported by the server"
+	next
+}
+{ v[++n] = $3; cpu += $4; snaps += $5 }
+END { flush() }'
+
+# Docking storm: monitors are added and removed as fast as xrandr runs,
+# ending with all of them removed, and the last snapshot must show none
+count=$(snapshots)
+before=$(snapshot "$count")
+first=$(now_ms)
+k=0
+while [ $k -lt "$STORM" ]; do
+	xrandr --setmonitor "STORM-$k" 1920/510x1080/290+0+0 none
+	[ $k -gt 0 ] && xrandr --delmonitor "STORM-$((k-1))"
+	k=$((k+1))
+done
+start=$(now_ms)
+xrandr --delmonitor "STORM-$((k-1))"
+last=$(settle "$count" "$start")
+if [ -z "$last" ]; then
+	echo "Docking storm: no snapshot within $TIMEOUT_MS ms"
+	exit 1
+fi
+set -- $before $(snapshot "$last")
+changes=$((2*STORM))
+printf '\nDocking storm: %d changes in %d ms, %d snapshots\n' \
+	$changes $((start - first)) $((last - count))
+printf 'Settled %d ms after the last change, %d us CPU (%d us per change)\n' \
+	$(($3 - start)) $(($4 - $2)) $((($4 - $2) / changes))
+if awk -v n="$last" '/^@/ { ++k } k == n && /STORM-/ { found = 1 } END { exit !found }' "$LOG"; then
+	echo "Last snapshot still shows storm monitors"
+	exit 1
+fi
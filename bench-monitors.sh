@@ -0,0 +1,57 @@
+#!/bin/sh
+# Measure how the xdpi run time and memory use grow with the number of
+# RANDR monitors, on a private Xvfb server.
+#
+# Usage: ./bench-monitors.sh [COUNT...]
+#
+# Monitors are added with xrandr --setmonitor up to each COUNT (default:
+# 10 100 1000 5000), and xdpi is timed with and without --fast at each step,
+# and with --output and --monitor, to compare a single-output (or monitor)
+# query against the full pass. Requires Xvfb, xrandr and GNU time.
+
+XDPI="${XDPI:-./xdpi}"
+DISPLAY_NUM="${DISPLAY_NUM:-98}"
+COUNTS="${*:-10 100 1000 5000}"
+TIME="${TIME:-/usr/bin/time}"
+
+Xvfb ":$DISPLAY_NUM" -screen 0 16000x10000x24 +extension RANDR -nolisten tcp 2>/dev/null &
+XVFB_PID=$!
+trap 'kill $XVFB_PID 2>/dev/null' EXIT
+export DISPLAY=":$DISPLAY_NUM"
+
+i=0
+until xrandr >/dev/null 2>&1; do
+	i=$((i+1))
+	[ $i -gt 50 ] && { echo "Xvfb did not start" >&2; exit 1; }
+	sleep 0.1
+done
+
+# The output to query alone: the first connected one
+OUTPUT=$(xrandr | awk '$2 == "connected" { print $1; exit }')
+
+# run LABEL ARGS...: time xdpi, printing the elapsed time and maximum RSS
+run() {
+	stats=$("$TIME" -f '%e %M' "$XDPI" "$@" 2>&1 >/dev/null | tail -n 1)
+	set -- $stats
+	printf ' %10.0f %10s' "$(echo "$1 * 1000" | bc)" "$2"
+}
+
+printf '%8s %10s %10s %10s %10s %10s %10s %10s %10s\n' monitors "ms" "max KB" \
+	"fast ms" "fast KB" "output ms" "output KB" "monitor ms" "monitor KB"
+
+added=0
+for count in $COUNTS; do
+	# 160x160 pixel monitors (about 100 dpi), tiled over the screen
+	while [ $added -lt "$count" ]; do
+		x=$(( (added % 100) * 160 ))
+		y=$(( (added / 100 % 62) * 160 ))
+		xrandr --setmonitor "BENCH-$added" "160/40x160/40+$x+$y" none
+		added=$((added+1))
+	done
+	printf '%8d' "$count"
+	run
+	run --fast
+	run --output "$OUTPUT"
+	run --monitor BENCH-0
+	echo
+done
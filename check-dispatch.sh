@@ -0,0 +1,116 @@
+#!/bin/sh
+# Check that xdpi_async_dispatch does not wait for the server, by running
+# xdpi-epoll through xlag against a private Xvfb server while monitors are
+# added and removed.
+#
+# Usage: ./check-dispatch.sh [DELAY...]
+#
+# For each round-trip DELAY in milliseconds (default: 10 50 200), xdpi-epoll
+# runs through xlag while CHANGES monitor changes (default: 10) are made on
+# the server. The check fails if any dispatch call waited for a reply (or
+# to send requests) that was not already there, as counted by xdpi-epoll,
+# or if it did not report any change. As a secondary check, it also fails
+# if the longest dispatch call took more than MAX_DISPATCH_MS (default: 5).
+# Requires Xvfb and xrandr; build xlag and xdpi-epoll with
+# `make xlag xdpi-epoll` first.
+
+XDPI_EPOLL="${XDPI_EPOLL:-./xdpi-epoll}"
+XLAG="${XLAG:-./xlag}"
+DISPLAY_NUM="${DISPLAY_NUM:-94}"
+LAG_NUM="${LAG_NUM:-93}"
+DELAYS="${*:-10 50 200}"
+CHANGES="${CHANGES:-10}"
+MAX_DISPATCH_MS="${MAX_DISPATCH_MS:-5}"
+
+OUT="$(mktemp)"
+ERR="$(mktemp)"
+
+cleanup() {
+	kill $EPOLL_PID $LAG_PID $XVFB_PID 2>/dev/null
+	rm -f "$OUT" "$ERR"
+}
+trap cleanup EXIT
+
+Xvfb ":$DISPLAY_NUM" -screen 0 3840x2160x24 +extension RANDR -nolisten tcp -ac 2>/dev/null &
+XVFB_PID=$!
+export DISPLAY=":$DISPLAY_NUM"
+
+i=0
+until xrandr >/dev/null 2>&1; do
+	i=$((i+1))
+	[ $i -gt 50 ] && { echo "Xvfb did not start" >&2; exit 1; }
+	sleep 0.1
+done
+
+# snapshots: number of snapshots reported so far
+snapshots() {
+	grep -c '^@' "$OUT"
+}
+
+failed=0
+
+printf '%6s %8s %10s %6s %12s\n' "RTT ms" changes snapshots waits "longest ms"
+
+for delay in $DELAYS; do
+	"$XLAG" -d "$delay" -l "$LAG_NUM" -t ":$DISPLAY_NUM" 2>/dev/null &
+	LAG_PID=$!
+	i=0
+	until [ -S "/tmp/.X11-unix/X$LAG_NUM" ]; do
+		i=$((i+1))
+		[ $i -gt 50 ] && { echo "xlag did not start" >&2; exit 1; }
+		sleep 0.1
+	done
+
+	: > "$OUT"
+	"$XDPI_EPOLL" --timestamps ":$LAG_NUM" > "$OUT" 2> "$ERR" &
+	EPOLL_PID=$!
+
+	# Wait for the first snapshot, then change the monitors on the
+	# server directly, faster than the proxy delivers the events
+	i=0
+	until [ "$(snapshots)" -ge 1 ]; do
+		i=$((i+1))
+		[ $i -gt 100 ] && break
+		sleep 0.1
+	done
+	first=$(snapshots)
+	k=0
+	while [ $k -lt "$CHANGES" ]; do
+		if [ $((k % 2)) -eq 0 ]; then
+			xrandr --setmonitor CHECK-1 1920/510x1080/290+0+0 none >/dev/null
+		else
+			xrandr --delmonitor CHECK-1 >/dev/null
+		fi
+		k=$((k+1))
+	done
+	sleep $(awk -v d="$delay" 'BEGIN { print 0.5 + d*10/1000 }')
+
+	kill -INT $EPOLL_PID
+	wait $EPOLL_PID 2>/dev/null
+	EPOLL_PID=
+
+	# xdpi-epoll: N dispatch calls, longest: T ms
+	longest=$(awk '/dispatch calls, longest:/ { sub("ms", "", $5); print $5 }' "$ERR")
+	# xdpi-epoll: R blocking waits for replies, W for writes
+	waits=$(awk '/blocking waits for replies/ { print $1 + $6 }' "$ERR")
+	changes=$(($(snapshots) - first))
+
+	status=ok
+	if [ -z "$longest" ] || [ -z "$waits" ] || [ "$first" -lt 1 ]; then
+		status="FAILED (no report)"
+	elif [ "$waits" -gt 0 ]; then
+		status="FAILED (blocked $waits times)"
+	elif awk -v t="$longest" -v max="$MAX_DISPATCH_MS" 'BEGIN { exit !(t > max) }'; then
+		status="FAILED (more than $MAX_DISPATCH_MS ms)"
+	elif [ "$changes" -lt 1 ]; then
+		status="FAILED (no change seen)"
+	fi
+	[ "$status" = ok ] || failed=1
+	printf '%6s %8s %10s %6s %12s  %s\n' "$delay" "$CHANGES" "$changes" "${waits:--}" "${longest:--}" "$status"
+
+	kill $LAG_PID
+	wait $LAG_PID 2>/dev/null
+	rm -f "/tmp/.X11-unix/X$LAG_NUM"
+done
+
+exit $failed
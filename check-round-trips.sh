@@ -0,0 +1,98 @@
+#!/bin/sh
+# Check the round trips and time taken by xdpi --fast over high-latency
+# links, by running it through xlag against a private Xvfb server.
+#
+# Usage: ./check-round-trips.sh [DELAY...]
+#
+# For each round-trip DELAY in milliseconds (default: 1 10 50), xdpi --fast
+# is run alone and with --output, and the round trips counted by xlag
+# (server replies following client requests) are checked against the
+# count xdpi reports, plus two for the connection setup and the extension
+# data. The check fails if they differ, or if xdpi reports more than
+# MAX_ROUND_TRIPS (default: 2).
+# Requires Xvfb and xrandr; build xlag with `make xlag` first.
+
+XDPI="${XDPI:-./xdpi}"
+XLAG="${XLAG:-./xlag}"
+DISPLAY_NUM="${DISPLAY_NUM:-96}"
+LAG_NUM="${LAG_NUM:-95}"
+DELAYS="${*:-1 10 50}"
+MAX_ROUND_TRIPS="${MAX_ROUND_TRIPS:-2}"
+
+LOG="$(mktemp)"
+
+cleanup() {
+	kill $LAG_PID $XVFB_PID 2>/dev/null
+	rm -f "$LOG"
+}
+trap cleanup EXIT
+
+Xvfb ":$DISPLAY_NUM" -screen 0 3840x2160x24 +extension RANDR -nolisten tcp -ac 2>/dev/null &
+XVFB_PID=$!
+export DISPLAY=":$DISPLAY_NUM"
+
+i=0
+until xrandr >/dev/null 2>&1; do
+	i=$((i+1))
+	[ $i -gt 50 ] && { echo "Xvfb did not start" >&2; exit 1; }
+	sleep 0.1
+done
+
+OUTPUT=$(xrandr | awk '$2 == "connected" { print $1; exit }')
+
+failed=0
+
+# check DELAY ARGS...: run xdpi --fast ARGS through the proxy, and compare
+# the round trips it reports with those seen by xlag
+check() {
+	delay="$1"
+	shift
+	closed=$(grep -c 'closed after' "$LOG")
+	# with --output, the counts are written to stderr
+	report=$(DISPLAY=":$LAG_NUM" "$XDPI" --fast "$@" 2>&1)
+	reported=$(echo "$report" | awk '$1 == "round" && $2 == "trips:" { print $3; exit }')
+	ms=$(echo "$report" | awk '$1 == "time:" { sub("ms", "", $2); print $2; exit }')
+
+	# xlag: connection N closed after R round trips, T ms
+	i=0
+	until [ "$(grep -c 'closed after' "$LOG")" -gt "$closed" ]; do
+		i=$((i+1))
+		[ $i -gt 50 ] && break
+		sleep 0.1
+	done
+	seen=$(awk -v n="$closed" '/closed after/ && k++ == n { print $6; exit }' "$LOG")
+
+	status=ok
+	if [ -z "$reported" ] || [ -z "$seen" ]; then
+		status="FAILED (no count)"
+	elif [ "$seen" -ne $((reported + 2)) ]; then
+		status="FAILED (xlag saw $seen, expected $((reported + 2)))"
+	elif [ "$reported" -gt "$MAX_ROUND_TRIPS" ]; then
+		status="FAILED (more than $MAX_ROUND_TRIPS)"
+	fi
+	[ "$status" = ok ] || failed=1
+	printf '%6s %-24s %6s %6s %8s  %s\n' "$delay" "--fast $*" \
+		"${reported:--}" "${seen:--}" "${ms:--}" "$status"
+}
+
+printf '%6s %-24s %6s %6s %8s\n' "RTT ms" options reported xlag "time ms"
+
+for delay in $DELAYS; do
+	"$XLAG" -d "$delay" -l "$LAG_NUM" -t ":$DISPLAY_NUM" 2>> "$LOG" &
+	LAG_PID=$!
+	i=0
+	until [ -S "/tmp/.X11-unix/X$LAG_NUM" ]; do
+		i=$((i+1))
+		[ $i -gt 50 ] && { echo "xlag did not start" >&2; exit 1; }
+		sleep 0.1
+	done
+
+	check "$delay"
+	check "$delay" --output "$OUTPUT"
+
+	kill $LAG_PID
+	wait $LAG_PID 2>/dev/null
+	rm -f "/tmp/.X11-unix/X$LAG_NUM"
+done
+
+exit $failed
@@ -0,0 +1,79 @@
+#!/bin/sh
+# Measure how long Qt takes to notice RANDR layout and Xft.dpi changes,
+# to tell if slow DPI reactions after docking come from the toolkit
+# or from the session. Runs qtdpi --watch on a private Xvfb server.
+
+QTDPI="${QTDPI:-./qtdpi}"
+DISPLAY_NUM="${DISPLAY_NUM:-99}"
+TIMEOUT_MS="${TIMEOUT_MS:-5000}"
+
+LOG="$(mktemp)"
+
+now_ms() {
+	date +%s%3N
+}
+
+cleanup() {
+	kill $QTDPI_PID $XVFB_PID 2>/dev/null
+	rm -f "$LOG"
+}
+trap cleanup EXIT
+
+Xvfb ":$DISPLAY_NUM" -screen 0 3840x2160x24 +extension RANDR -nolisten tcp 2>/dev/null &
+XVFB_PID=$!
+export DISPLAY=":$DISPLAY_NUM"
+
+# Wait for the server
+i=0
+until xrandr >/dev/null 2>&1; do
+	i=$((i+1))
+	[ $i -gt 50 ] && { echo "Xvfb did not start" >&2; exit 1; }
+	sleep 0.1
+done
+
+"$QTDPI" --watch > "$LOG" &
+QTDPI_PID=$!
+
+until grep -q '^READY' "$LOG"; do
+	kill -0 $QTDPI_PID 2>/dev/null || { echo "qtdpi --watch failed" >&2; exit 1; }
+	sleep 0.1
+done
+
+# measure LABEL PATTERN COMMAND...
+# Run the command, and report the delay until qtdpi logs an event
+# matching PATTERN
+measure() {
+	label="$1"
+	pattern="$2"
+	shift 2
+	start=$(now_ms)
+	"$@" >/dev/null 2>&1
+	while :; do
+		seen=$(awk -v start="$start" -v pattern="$pattern" \
+			'$1 == "EVENT" && $2 >= start && $3 ~ pattern { print $2; exit }' "$LOG")
+		if [ -n "$seen" ]; then
+			printf '%-32s %6d ms\n' "$label" $((seen - start))
+			return
+		fi
+		if [ $(($(now_ms) - start)) -gt "$TIMEOUT_MS" ]; then
+			printf '%-32s   none seen in %d ms\n' "$label" "$TIMEOUT_MS"
+			return
+		fi
+		sleep 0.01
+	done
+}
+
+merge_xft_dpi() {
+	echo "Xft.dpi: $1" | xrdb -merge
+}
+
+measure "add monitor" 'screenAdded|DotsPerInch' \
+	xrandr --setmonitor XDPI-TEST 1920/300x1080/170+0+0 none
+measure "physical size change" 'physicalDotsPerInch' \
+	xrandr --fb 3840x2160 --dpi 192
+measure "Xft.dpi change" 'logicalDotsPerInch' \
+	merge_xft_dpi 144
+measure "remove monitor" 'screenRemoved|DotsPerInch' \
+	xrandr --delmonitor XDPI-TEST
+measure "Xft.dpi restore" 'logicalDotsPerInch' \
+	merge_xft_dpi 96
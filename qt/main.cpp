@@ -1,7 +1,15 @@
 #include <QGuiApplication>
+#include <QDateTime>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QProcess>
 #include <QScreen>
+#include <QThread>
+#include <QVector>
 
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
 
 using namespace std;
@@ -39,12 +47,258 @@ void allDpiInfo(int argc, char *argv[])
 	dpiInfo<true, true>(argc, argv);
 }
 
+// Watch mode: stay running, and log (with a millisecond timestamp since the epoch)
+// every screen hotplug and DPI change seen by Qt, so that the delay between
+// a change in the session and Qt noticing it can be measured (see dpi-latency.sh)
+
+static void logEvent(const char *what, const QScreen *screen, qreal value = 0)
+{
+	cout << "EVENT " << QDateTime::currentMSecsSinceEpoch() << " " << what << " " <<
+		screen->name().toStdString() << " " << value << endl;
+}
+
+static void watchScreen(QScreen *screen)
+{
+	QObject::connect(screen, &QScreen::physicalDotsPerInchChanged, [screen](qreal dpi) {
+		logEvent("physicalDotsPerInchChanged", screen, dpi);
+	});
+	QObject::connect(screen, &QScreen::logicalDotsPerInchChanged, [screen](qreal dpi) {
+		logEvent("logicalDotsPerInchChanged", screen, dpi);
+	});
+}
+
+int watchDpi(int argc, char *argv[])
+{
+	QGuiApplication app(argc, argv);
+
+	foreach(QScreen *screen, QGuiApplication::screens()) {
+		logEvent("screen", screen, screen->physicalDotsPerInch());
+		watchScreen(screen);
+	}
+
+	QObject::connect(&app, &QGuiApplication::screenAdded, [](QScreen *screen) {
+		logEvent("screenAdded", screen, screen->physicalDotsPerInch());
+		watchScreen(screen);
+	});
+	QObject::connect(&app, &QGuiApplication::screenRemoved, [](QScreen *screen) {
+		logEvent("screenRemoved", screen);
+	});
+
+	cout << "READY " << QDateTime::currentMSecsSinceEpoch() << endl;
+
+	return app.exec();
+}
+
+// Matrix mode: run every combination of the given environment variable values
+// (e.g. QT_SCALE_FACTOR=1,1.5,2) and of the high-DPI attributes, each in its
+// own child process, as many at once as there are cores, and gather the
+// per-screen results in a single table
+
+static const char *matrixChildFlag = "--matrix-child";
+
+// Print the per-screen results as tab-separated rows, for the parent process
+template<bool enable, bool disable>
+void dpiRows(int argc, char *argv[])
+{
+	QGuiApplication::setAttribute(Qt::AA_EnableHighDpiScaling, enable);
+	QGuiApplication::setAttribute(Qt::AA_DisableHighDpiScaling, disable);
+
+	QGuiApplication app(argc, argv);
+
+	foreach(QScreen *screen, QGuiApplication::screens()) {
+		QRect geom = screen->geometry();
+		cout << "ROW\t" << screen->name().toStdString() << "\t" <<
+			geom.width() << "x" << geom.height() << "+" << geom.left() << "+" << geom.top() << "\t" <<
+			screen->physicalDotsPerInch() << "\t" <<
+			screen->logicalDotsPerInch() << "\t" <<
+			screen->devicePixelRatio() << "\n";
+	}
+}
+
+// The attributes are numbered as in allDpiInfo: enable is bit 1, disable bit 0
+int matrixChild(int argc, char *argv[])
+{
+	const int attrs = argc > 2 ? atoi(argv[2]) : 0;
+	switch (attrs) {
+	case 0: dpiRows<false, false>(argc, argv); break;
+	case 1: dpiRows<false, true>(argc, argv); break;
+	case 2: dpiRows<true, false>(argc, argv); break;
+	case 3: dpiRows<true, true>(argc, argv); break;
+	default: return 2;
+	}
+	return 0;
+}
+
+struct MatrixVar
+{
+	QString name;
+	QStringList values; // an empty value leaves the variable unset
+};
+
+struct MatrixJob
+{
+	QStringList values; // one per variable
+	int attrs;
+	int exitCode;
+	QByteArray output;
+	QByteArray errors;
+};
+
+static void printTable(const QVector<QStringList> &rows)
+{
+	QVector<int> width;
+	foreach(const QStringList &row, rows) {
+		for (int c = 0; c < row.size(); ++c) {
+			if (c >= width.size())
+				width.append(0);
+			width[c] = qMax(width[c], row[c].size());
+		}
+	}
+	foreach(const QStringList &row, rows) {
+		QString line;
+		for (int c = 0; c < row.size(); ++c)
+			line += row[c].leftJustified(width[c] + 2);
+		cout << line.trimmed().toStdString() << "\n";
+	}
+}
+
+int dpiMatrix(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QVector<MatrixVar> vars;
+	int maxJobs = QThread::idealThreadCount();
+	for (int i = 2; i < argc; ++i) {
+		const QString arg = QString::fromLocal8Bit(argv[i]);
+		const int eq = arg.indexOf('=');
+		if (arg == "--jobs" && i + 1 < argc) {
+			maxJobs = atoi(argv[++i]);
+		} else if (eq > 0) {
+			// QT_SCREEN_SCALE_FACTORS values use ';' between screens, so ',' is free
+			MatrixVar var = { arg.left(eq), arg.mid(eq + 1).split(',') };
+			vars.append(var);
+		} else {
+			cerr << "usage: " << argv[0] << " --matrix [--jobs N] [VAR=VALUE,VALUE...]...\n";
+			return 2;
+		}
+	}
+	if (maxJobs < 1)
+		maxJobs = 1;
+
+	// The cartesian product of the variable values, times the attributes
+	QVector<MatrixJob> jobs;
+	QVector<int> index(vars.size(), 0);
+	for (;;) {
+		QStringList values;
+		for (int v = 0; v < vars.size(); ++v)
+			values << vars[v].values[index[v]];
+		for (int attrs = 0; attrs < 4; ++attrs) {
+			MatrixJob job = { values, attrs, -1, QByteArray(), QByteArray() };
+			jobs.append(job);
+		}
+		int v = vars.size() - 1;
+		while (v >= 0 && ++index[v] == vars[v].values.size())
+			index[v--] = 0;
+		if (v < 0)
+			break;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	int next = 0, running = 0;
+	std::function<void()> startJobs = [&]() {
+		while (running < maxJobs && next < jobs.size()) {
+			const int j = next++;
+			QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+			for (int v = 0; v < vars.size(); ++v) {
+				if (jobs[j].values[v].isEmpty())
+					env.remove(vars[v].name);
+				else
+					env.insert(vars[v].name, jobs[j].values[v]);
+			}
+
+			QProcess *proc = new QProcess(&app);
+			proc->setProcessEnvironment(env);
+			auto done = [&, proc, j](int exitCode) {
+				jobs[j].exitCode = exitCode;
+				jobs[j].output = proc->readAllStandardOutput();
+				jobs[j].errors = proc->readAllStandardError();
+				proc->deleteLater();
+				--running;
+				startJobs();
+				if (!running)
+					app.quit();
+			};
+			QObject::connect(proc, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+				[done](int exitCode, QProcess::ExitStatus status) {
+					done(status == QProcess::NormalExit ? exitCode : -1);
+				});
+			QObject::connect(proc, &QProcess::errorOccurred, [done](QProcess::ProcessError error) {
+				if (error == QProcess::FailedToStart)
+					done(-1);
+			});
+			++running;
+			proc->start(QCoreApplication::applicationFilePath(),
+				QStringList() << matrixChildFlag << QString::number(jobs[j].attrs));
+		}
+	};
+	startJobs();
+	if (running)
+		app.exec();
+
+	QVector<QStringList> rows;
+	QStringList header;
+	foreach(const MatrixVar &var, vars)
+		header << var.name;
+	header << "Enable/Disable" << "Screen" << "Geometry" << "Physical DPI" << "Logical DPI" << "Pixel ratio";
+	rows << header;
+
+	int failed = 0;
+	foreach(const MatrixJob &job, jobs) {
+		QStringList prefix;
+		foreach(const QString &value, job.values)
+			prefix << (value.isEmpty() ? "-" : value);
+		prefix << QString("%1/%2").arg(job.attrs >> 1).arg(job.attrs & 1);
+
+		if (job.exitCode) {
+			++failed;
+			rows << (QStringList(prefix) << QString("(failed: %1)").arg(
+				QString::fromLocal8Bit(job.errors).trimmed().section('\n', 0, 0)));
+			continue;
+		}
+		foreach(const QByteArray &line, job.output.split('\n')) {
+			if (!line.startsWith("ROW\t"))
+				continue;
+			QStringList row(prefix);
+			row << QString::fromUtf8(line.mid(4)).split('\t');
+			rows << row;
+		}
+	}
+	printTable(rows);
+
+	cout << jobs.size() << " combinations in " << timer.elapsed() << "ms, " <<
+		maxJobs << " at a time";
+	if (failed)
+		cout << ", " << failed << " failed";
+	cout << "\n";
+
+	return failed ? 1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
 	QString qt_version = QString("QT version: 0x") + QString::number(QT_VERSION, 16);
 
 	cout << qt_version.toStdString() << "\n";
 
+	if (argc > 1 && !strcmp(argv[1], "--watch"))
+		return watchDpi(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "--matrix"))
+		return dpiMatrix(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], matrixChildFlag))
+		return matrixChild(argc, argv);
+
 	allDpiInfo(argc, argv);
 
 	// TODO on Windows, redo after setting DPI awareness
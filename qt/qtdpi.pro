@@ -2,6 +2,11 @@ lessThan(QT_MAJOR_VERSION, 5) {
 	error("qtdpitest requires Qt version 5, $$[QT_VERSION] found")
 }
 
+# QProcess::errorOccurred, used by the environment matrix
+equals(QT_MAJOR_VERSION, 5):lessThan(QT_MINOR_VERSION, 6) {
+	error("qtdpitest requires Qt version 5.6 or later, $$[QT_VERSION] found")
+}
+
 TEMPLATE = app
 VERSION = 1.0
 
@@ -0,0 +1,653 @@
+/* Benchmark and fuzz harness for the xdpi code that does not talk to the
+ * X server: the DPI math, the scaling factors, the XSETTINGS parsing, the
+ * monitor spatial index and the change journal.
+ * Licensed under the terms of the Mozilla Public License, version 2.
+ * See LICENSE.txt for details.
+ */
+
+/* The functions under test are static, so xdpi.c is included directly,
+ * with its main renamed out of the way. Build with `make bench`, which runs
+ * the harness under the address and undefined behavior sanitizers (use
+ * `make bench sanitize=` for realistic throughput).
+ *
+ * Usage: ./xdpi-bench [seed [scale]]
+ *
+ * All inputs are generated from the seed, so failures can be reproduced;
+ * scale multiplies the number of iterations of each test.
+ */
+
+#define main xdpi_main
+#include "xdpi.c"
+#undef main
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64* */
+static uint64_t rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static int rng_range(int lo, int hi)
+{
+	return lo + (int)(rng() % (uint64_t)(hi - lo + 1));
+}
+
+static int failures = 0;
+
+/* Report a failure; only the first few are shown */
+static void fail(const char *test, const char *fmt, ...)
+{
+	if (failures++ >= 10)
+		return;
+	va_list ap;
+	va_start(ap, fmt);
+	fprintf(stderr, "FAIL %s: ", test);
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+	va_end(ap);
+}
+
+static void throughput(const char *test, long count, const char *unit, double ms)
+{
+	printf("%-24s %10ld %s in %8.1fms: %8.2f M%s/s\n", test, count, unit, ms,
+		ms > 0 ? count/ms/1000 : 0, unit);
+}
+
+/*
+ * DPI math
+ */
+
+static void bench_dpi_common(long iters)
+{
+	/* Known monitors, and exact halves, which must round up */
+	static const struct {
+		int w, h, mmw, mmh, dpi;
+	} known[] = {
+		{ 1920, 1080, 508, 286, 96 },	/* 23" 1080p */
+		{ 3840, 2160, 600, 340, 161 },	/* 27" 4K */
+		{ 2560, 1440, 597, 336, 109 },	/* 27" 1440p */
+		{ 1920, 1080, 600, 286, 96 },	/* vertical DPI is preferred */
+		{ 1920, 1080, 508, 0, 96 },	/* no height: horizontal DPI */
+		{ 1920, 1080, 0, 0, 0 },	/* no size */
+		{ 2100, 1050, 1016, 508, 53 },	/* 52.5 */
+		{ 5, 5, 254, 254, 1 },		/* 0.5 */
+	};
+	for (size_t k = 0; k < sizeof(known)/sizeof(*known); ++k) {
+		const int dpi = print_dpi_common(NULL, known[k].w, known[k].h,
+			known[k].mmw, known[k].mmh);
+		if (dpi != known[k].dpi)
+			fail("print_dpi_common", "%dx%d pixels, %dx%d mm: got %d, expected %d",
+				known[k].w, known[k].h, known[k].mmw, known[k].mmh,
+				dpi, known[k].dpi);
+	}
+
+	/* Sweep the common sizes, plus random and degenerate ones */
+	long calls = 0;
+	long checksum = 0;
+	const double start = now_ms();
+	for (long k = 0; k < iters; ++k) {
+		const int w = (k & 7) ? rng_range(1, 16384) : rng_range(0, 1);
+		const int h = (k & 7) ? rng_range(1, 16384) : rng_range(0, 1);
+		const int mmw = (k & 15) ? rng_range(1, 2000) : 0;
+		const int mmh = (k & 31) ? rng_range(1, 2000) : 0;
+		const int dpi = print_dpi_common(NULL, w, h, mmw, mmh);
+		++calls;
+		checksum += dpi;
+
+		/* At most 16384 pixels on a 1mm side */
+		if (dpi < 0 || dpi > (int)round(16384*25.4))
+			fail("print_dpi_common", "%dx%d pixels, %dx%d mm: got %d",
+				w, h, mmw, mmh, dpi);
+	}
+	throughput("print_dpi_common", calls, "calls", now_ms() - start);
+	if (checksum < 0)
+		fail("print_dpi_common", "negative DPI");
+}
+
+static void bench_calc_scaling(long iters)
+{
+	long checksum = 0;
+	const double start = now_ms();
+	for (long k = 0; k < iters; ++k) {
+		/* Cover the exact halves, where rounding matters */
+		const float actual = (k & 1) ? (float)(rng() % 100000)/1000.0f :
+			(float)(rng() % 64)/2.0f;
+		const struct scaling_factor s = calc_scaling(actual);
+		checksum += s.min + s.round + s.max;
+		if (s.min < 1 || s.round < 1 || s.max < 1 ||
+			s.min > s.round || s.round > s.max || s.max - s.min > 1 ||
+			(actual >= 1 && (s.min > actual || s.max < actual)))
+			fail("calc_scaling", "%g: %d %d %d", actual, s.min, s.round, s.max);
+	}
+	throughput("calc_scaling", iters, "calls", now_ms() - start);
+	if (checksum < iters)
+		fail("calc_scaling", "scaling below 1");
+}
+
+static void bench_pad_to_int32(void)
+{
+	long checksum = 0;
+	const int limit = 1 << 24;
+	const double start = now_ms();
+	for (int n = 0; n < limit; ++n) {
+		const int padded = pad_to_int32(n);
+		checksum += padded;
+		if ((padded & 3) || padded < n || padded - n > 3)
+			fail("pad_to_int32", "%d: got %d", n, padded);
+	}
+	throughput("pad_to_int32", limit, "calls", now_ms() - start);
+	if (checksum < 0)
+		fail("pad_to_int32", "overflow");
+}
+
+/*
+ * XSETTINGS parsing
+ */
+
+struct blob
+{
+	unsigned char *data;
+	size_t len, size;
+	Bool swap;
+};
+
+static void blob_reserve(struct blob *b, size_t extra)
+{
+	if (b->len + extra <= b->size)
+		return;
+	while (b->len + extra > b->size)
+		b->size = b->size ? 2*b->size : 256;
+	b->data = realloc(b->data, b->size);
+	if (!b->data) error("out of memory for XSETTINGS blobs");
+}
+
+static void blob_card8(struct blob *b, uint8_t v)
+{
+	blob_reserve(b, 1);
+	b->data[b->len++] = v;
+}
+
+static void blob_card16(struct blob *b, uint16_t v)
+{
+	blob_reserve(b, 2);
+	v = xsettings_card16((const unsigned char*)&v, b->swap);
+	memcpy(b->data + b->len, &v, 2);
+	b->len += 2;
+}
+
+static void blob_card32(struct blob *b, uint32_t v)
+{
+	blob_reserve(b, 4);
+	v = xsettings_card32((const unsigned char*)&v, b->swap);
+	memcpy(b->data + b->len, &v, 4);
+	b->len += 4;
+}
+
+static void blob_bytes(struct blob *b, const char *bytes, size_t len)
+{
+	blob_reserve(b, pad_to_int32(len));
+	memcpy(b->data + b->len, bytes, len);
+	memset(b->data + b->len + len, 0, pad_to_int32(len) - len);
+	b->len += pad_to_int32(len);
+}
+
+static void blob_entry(struct blob *b, int type, const char *name)
+{
+	blob_card8(b, type);
+	blob_card8(b, 0);
+	blob_card16(b, strlen(name));
+	blob_bytes(b, name, strlen(name));
+	blob_card32(b, rng()); /* last change serial */
+	switch (type) {
+	case XSETTINGS_TYPE_INT:
+		blob_card32(b, rng());
+		break;
+	case XSETTINGS_TYPE_COLOR:
+		blob_card32(b, rng());
+		blob_card32(b, rng());
+		break;
+	case XSETTINGS_TYPE_STRING: {
+		char value[64];
+		const int len = rng_range(0, sizeof(value));
+		memset(value, 'v', len);
+		blob_card32(b, len);
+		blob_bytes(b, value, len);
+		break;
+	}
+	}
+}
+
+/* Generate valid XSETTINGS data with the given number of entries
+ * of mixed types, with Xft/DPI at the given position (if in range).
+ * Returns the Xft/DPI value.
+ */
+static int32_t blob_generate(struct blob *b, int entries, int xft_dpi_at, int xft_dpi_type)
+{
+	static const char *names[] = {
+		"Net/ThemeName", "Gtk/FontName", "Xft/Antialias", "Xft/DPI0",
+		"Xft/DP", "Gtk/CursorThemeSize", "Net/IconThemeName", "X"
+	};
+	const int32_t xft_dpi = rng_range(1, 1000)*1024;
+
+	b->len = 0;
+	b->swap = rng() & 1;
+	blob_card8(b, b->swap ? (xsettings_native_byte_order() == LSBFirst ? MSBFirst : LSBFirst) :
+		xsettings_native_byte_order());
+	blob_card8(b, 0);
+	blob_card16(b, 0);
+	blob_card32(b, rng()); /* serial */
+	blob_card32(b, entries);
+	for (int k = 0; k < entries; ++k) {
+		if (k == xft_dpi_at) {
+			blob_card8(b, xft_dpi_type);
+			blob_card8(b, 0);
+			blob_card16(b, 7);
+			blob_bytes(b, "Xft/DPI", 7);
+			blob_card32(b, rng());
+			if (xft_dpi_type == XSETTINGS_TYPE_INT) {
+				blob_card32(b, xft_dpi);
+				continue;
+			}
+			/* Fill in the rest of the wrongly typed entry */
+			if (xft_dpi_type == XSETTINGS_TYPE_COLOR) {
+				blob_card32(b, 0);
+				blob_card32(b, 0);
+			} else {
+				blob_card32(b, 0);
+			}
+			continue;
+		}
+		blob_entry(b, rng_range(XSETTINGS_TYPE_INT, XSETTINGS_TYPE_COLOR),
+			names[rng() % (sizeof(names)/sizeof(*names))]);
+	}
+	return xft_dpi;
+}
+
+/* Parse a copy of the first len bytes of the blob, in a buffer of exactly
+ * that size, so that the sanitizers catch any read past its end
+ */
+static int parse_exact(const struct blob *b, size_t len, int32_t *xft_dpi)
+{
+	unsigned char *copy = malloc(len ? len : 1);
+	if (!copy) error("out of memory for XSETTINGS blobs");
+	memcpy(copy, b->data, len);
+	const int ret = xsettings_parse_xft_dpi(copy, len, xft_dpi);
+	free(copy);
+	return ret;
+}
+
+static void bench_xsettings(long iters)
+{
+	struct blob b = { .data = NULL };
+
+	/* Throughput on large valid blobs, Xft/DPI last */
+	long entries = 0;
+	long bytes = 0;
+	double elapsed = 0;
+	for (long k = 0; k < iters/1000 + 1; ++k) {
+		const int n = rng_range(1000, 5000);
+		const int32_t expected = blob_generate(&b, n, n - 1, XSETTINGS_TYPE_INT);
+		int32_t xft_dpi = 0;
+		const double start = now_ms();
+		const int ret = xsettings_parse_xft_dpi(b.data, b.len, &xft_dpi);
+		elapsed += now_ms() - start;
+		entries += n;
+		bytes += b.len;
+		if (ret != XSETTINGS_FOUND || xft_dpi != expected)
+			fail("xsettings", "%d entries: got %d (%d), expected %d", n, ret, xft_dpi, expected);
+	}
+	throughput("xsettings (entries)", entries, "entries", elapsed);
+	throughput("xsettings (bytes)", bytes, "bytes", elapsed);
+
+	/* Xft/DPI anywhere, missing, or with the wrong type */
+	for (long k = 0; k < iters/100; ++k) {
+		const int n = rng_range(0, 50);
+		const int at = rng_range(0, n + 5);
+		const int type = (k & 7) ? XSETTINGS_TYPE_INT : rng_range(XSETTINGS_TYPE_STRING, XSETTINGS_TYPE_COLOR);
+		const int32_t expected = blob_generate(&b, n, at, type);
+		int32_t xft_dpi = 0;
+		const int ret = parse_exact(&b, b.len, &xft_dpi);
+		const int expected_ret = at >= n ? XSETTINGS_NOT_FOUND :
+			type == XSETTINGS_TYPE_INT ? XSETTINGS_FOUND : XSETTINGS_WRONG_TYPE;
+		if (ret != expected_ret || (ret == XSETTINGS_FOUND && xft_dpi != expected))
+			fail("xsettings", "%d entries, Xft/DPI at %d: got %d, expected %d", n, at, ret, expected_ret);
+	}
+
+	/* Hostile data: truncated blobs, corrupted bytes and lengths,
+	 * entry counts larger than the data. We only check that nothing
+	 * is read out of bounds, and that the result is sensible
+	 */
+	long hostile = 0;
+	const double start = now_ms();
+	for (long k = 0; k < iters/10; ++k, ++hostile) {
+		const int n = rng_range(0, 20);
+		blob_generate(&b, n, rng_range(0, n), XSETTINGS_TYPE_INT);
+		size_t len = b.len;
+		switch (k % 4) {
+		case 0: /* truncate */
+			len = rng() % (b.len + 1);
+			break;
+		case 1: /* flip random bytes */
+			for (int f = rng_range(1, 8); f > 0; --f)
+				b.data[rng() % b.len] ^= 1 << (rng() & 7);
+			break;
+		case 2: /* overwrite random words with large values */
+			for (int f = rng_range(1, 4); f > 0; --f) {
+				const size_t at = (rng() % (b.len/4))*4;
+				const uint32_t v = (rng() & 1) ? 0xffffffffu : (uint32_t)rng();
+				memcpy(b.data + at, &v, 4);
+			}
+			break;
+		case 3: { /* claim more entries than there are */
+			uint32_t count = n + rng_range(1, 1000);
+			count = xsettings_card32((const unsigned char*)&count, b.swap);
+			memcpy(b.data + 8, &count, 4);
+			break;
+		}
+		}
+		int32_t xft_dpi = 0;
+		const int ret = parse_exact(&b, len, &xft_dpi);
+		if (ret < XSETTINGS_WRONG_TYPE || ret > XSETTINGS_FOUND)
+			fail("xsettings", "hostile blob: unexpected result %d", ret);
+		if (k % 4 == 3 && ret == XSETTINGS_NOT_FOUND)
+			fail("xsettings", "missing entries not detected");
+	}
+	throughput("xsettings (hostile)", hostile, "blobs", now_ms() - start);
+
+	free(b.data);
+}
+
+/*
+ * Monitor spatial index
+ */
+
+/* Reference lookup: the first record containing the point */
+static int brute_at(const struct named_dpi *recs, int nrecs, int x, int y)
+{
+	for (int k = 0; k < nrecs; ++k) {
+		const struct named_dpi *r = recs + k;
+		if (rect_valid(r) && x >= r->x && x < r->x + r->width &&
+			y >= r->y && y < r->y + r->height)
+			return k;
+	}
+	return -1;
+}
+
+/* Reference lookup: the record covering most of the rectangle, each part
+ * of it belonging to the first record containing it (as for brute_at).
+ * The rectangle is cut at the edges of the records it overlaps, and each
+ * cell is looked up by its corner. Ties go to the first record.
+ */
+static int brute_rect(const struct named_dpi *recs, int nrecs,
+	int x, int y, int width, int height)
+{
+	if (width <= 0 || height <= 0)
+		return brute_at(recs, nrecs, x, y);
+
+	const int x1 = x + width, y1 = y + height;
+	int *hits = calloc(nrecs + 1, sizeof(*hits));
+	int *xs = calloc(2*nrecs + 2, sizeof(*xs));
+	int *ys = calloc(2*nrecs + 2, sizeof(*ys));
+	long long *area = calloc(nrecs + 1, sizeof(*area));
+	if (!hits || !xs || !ys || !area) error("out of memory for the reference lookup");
+
+	int nhits = 0, nx = 0, ny = 0;
+	xs[nx++] = x;
+	xs[nx++] = x1;
+	ys[ny++] = y;
+	ys[ny++] = y1;
+	for (int k = 0; k < nrecs; ++k) {
+		const struct named_dpi *r = recs + k;
+		if (!rect_valid(r) || r->x >= x1 || r->x + r->width <= x ||
+			r->y >= y1 || r->y + r->height <= y)
+			continue;
+		hits[nhits++] = k;
+		if (r->x > x) xs[nx++] = r->x;
+		if (r->x + r->width < x1) xs[nx++] = r->x + r->width;
+		if (r->y > y) ys[ny++] = r->y;
+		if (r->y + r->height < y1) ys[ny++] = r->y + r->height;
+	}
+	nx = sort_unique(xs, nx);
+	ny = sort_unique(ys, ny);
+
+	for (int i = 0; i + 1 < nx; ++i) {
+		for (int j = 0; j + 1 < ny; ++j) {
+			for (int h = 0; h < nhits; ++h) {
+				const struct named_dpi *r = recs + hits[h];
+				if (xs[i] >= r->x && xs[i] < r->x + r->width &&
+					ys[j] >= r->y && ys[j] < r->y + r->height) {
+					area[hits[h]] += (long long)(xs[i+1] - xs[i])*(ys[j+1] - ys[j]);
+					break;
+				}
+			}
+		}
+	}
+
+	int best = -1;
+	for (int h = 0; h < nhits; ++h)
+		if (area[hits[h]] > 0 && (best < 0 || area[hits[h]] > area[best]))
+			best = hits[h];
+
+	free(area);
+	free(ys);
+	free(xs);
+	free(hits);
+	return best;
+}
+
+static void bench_dpi_index(long iters)
+{
+	const int nrecs = 1000;
+	struct named_dpi *recs = calloc(nrecs, sizeof(*recs));
+	if (!recs) error("out of memory for monitors");
+
+	/* A grid of monitors, with some overlapping and some invalid ones */
+	for (int k = 0; k < nrecs; ++k) {
+		struct named_dpi *r = recs + k;
+		r->dpi = rng_range(72, 300);
+		r->x = (k % 40)*1920 + ((k & 7) ? 0 : rng_range(-500, 500));
+		r->y = (k / 40)*1080 + ((k & 7) ? 0 : rng_range(-500, 500));
+		r->width = (k % 97) ? rng_range(800, 2500) : 0;
+		r->height = rng_range(600, 1500);
+		snprintf(r->name, STRMAX, "M%d", k);
+	}
+
+	double start = now_ms();
+	struct dpi_index *idx = dpi_index_build(recs, nrecs);
+	printf("%-24s %10d monitors in %8.1fms\n", "dpi_index_build", nrecs, now_ms() - start);
+
+	start = now_ms();
+	long checksum = 0;
+	for (long k = 0; k < iters; ++k)
+		checksum += dpi_index_at(idx, rng_range(-1000, 80000), rng_range(-1000, 30000));
+	throughput("dpi_index_at", iters, "lookups", now_ms() - start);
+
+	for (long k = 0; k < iters/100; ++k) {
+		const int x = rng_range(-1000, 80000);
+		const int y = rng_range(-1000, 30000);
+		const int got = dpi_index_at(idx, x, y);
+		const int expected = brute_at(recs, nrecs, x, y);
+		if (got != expected)
+			fail("dpi_index_at", "(%d,%d): got %d, expected %d", x, y, got, expected);
+	}
+
+	start = now_ms();
+	for (long k = 0; k < iters/10; ++k)
+		checksum += dpi_index_rect(idx, rng_range(-1000, 80000), rng_range(-1000, 30000),
+			rng_range(0, 4000), rng_range(0, 4000));
+	throughput("dpi_index_rect", iters/10, "lookups", now_ms() - start);
+
+	for (long k = 0; k < iters/1000; ++k) {
+		const int x = rng_range(-1000, 80000);
+		const int y = rng_range(-1000, 30000);
+		const int w = rng_range(0, 4000);
+		const int h = rng_range(0, 4000);
+		const int got = dpi_index_rect(idx, x, y, w, h);
+		const int expected = brute_rect(recs, nrecs, x, y, w, h);
+		if (got != expected)
+			fail("dpi_index_rect", "%dx%d+%d+%d: got %d, expected %d",
+				w, h, x, y, got, expected);
+	}
+
+	if (checksum < -iters - iters/10)
+		fail("dpi_index", "inconsistent results");
+
+	dpi_index_free(idx);
+	free(recs);
+}
+
+/*
+ * Change journal
+ */
+
+static const int journal_dpis[] = { 96, 144, 120, 192, 0, -1 };
+
+/* The outputs of the generated snapshot with the given sequence number,
+ * so that the dumped records can be checked against them
+ */
+static void journal_snapshot(unsigned seq)
+{
+	noutput[0] = 1 + seq % 4;
+	config_time[0] = seq;
+	for (int o = 0; o < noutput[0]; ++o) {
+		struct named_dpi *rec = output_dpi[0] + o;
+		memset(rec, 0, sizeof(*rec));
+		rec->dpi = journal_dpis[(seq + o) % 6];
+		rec->primary = !o;
+		rec->connection = rec->dpi < 0 ? RR_Disconnected : RR_Connected;
+		rec->x = o*1920;
+		rec->width = 1920;
+		rec->height = 1080;
+		rec->mmw = 508;
+		rec->mmh = 286;
+		snprintf(rec->name, STRMAX, "OUT-%u-%d", seq, o);
+	}
+}
+
+/* Append snapshots to a small journal, so that it wraps around and evicts
+ * records, then check that the dump shows the last ones as appended. The
+ * reference DPI is not 96, since the native scale does not depend on it
+ */
+static void bench_journal(long iters)
+{
+	char path[] = "/tmp/xdpi-bench-XXXXXX";
+	const int fd = mkstemp(path);
+	if (fd < 0) {
+		fail("journal", "cannot create %s", path);
+		return;
+	}
+	close(fd);
+
+	journal = journal_map(path, 4096, True);
+	reference_dpi = calloc(1, sizeof(*reference_dpi));
+	noutput = calloc(1, sizeof(*noutput));
+	config_time = calloc(1, sizeof(*config_time));
+	output_dpi = calloc(1, sizeof(*output_dpi));
+	if (!journal || !reference_dpi || !noutput || !config_time || !output_dpi ||
+		!(output_dpi[0] = calloc(4, sizeof(**output_dpi))))
+		error("cannot set up the journal");
+	reference_dpi[0] = 120;
+
+	const double start = now_ms();
+	for (long k = 0; k < iters; ++k) {
+		journal_snapshot(k);
+		journal_append(1);
+	}
+	throughput("journal_append", iters, "records", now_ms() - start);
+	if (journal->seq != (uint64_t)iters || journal->head - journal->tail > journal->capacity)
+		fail("journal", "%llu records, %llu bytes in use",
+			(unsigned long long)journal->seq,
+			(unsigned long long)(journal->head - journal->tail));
+
+	/* Dump to a temporary file in place of stdout */
+	FILE *dump = tmpfile();
+	const int saved = dup(STDOUT_FILENO);
+	if (!dump || saved < 0)
+		error("cannot capture the journal dump");
+	fflush(stdout);
+	dup2(fileno(dump), STDOUT_FILENO);
+	const int ret = journal_dump(path);
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	if (ret)
+		fail("journal", "dump failed");
+	rewind(dump);
+
+	char line[256];
+	long records = 0;
+	unsigned seq = 0, outputs = 0;
+	int o = 0;
+	while (fgets(line, sizeof(line), dump)) {
+		if (line[0] == '#') {
+			unsigned next, config, count;
+			float ref;
+			if (sscanf(line, "#%u %*s %*s screen 0: config time %u, reference %g DPI, %u outputs",
+				&next, &config, &ref, &count) != 4 ||
+				(records && next != seq + 1) || config != next ||
+				ref != reference_dpi[0] || count != 1 + next % 4) {
+				fail("journal", "unexpected record after #%u: %s", seq, line);
+				break;
+			}
+			++records;
+			seq = next;
+			outputs = count;
+			o = 0;
+			continue;
+		}
+		if (line[0] != '\t')
+			continue;
+
+		char name[64];
+		snprintf(name, sizeof(name), "\tOUT-%u-%d (", seq, o);
+		const int dpi = journal_dpis[(seq + o) % 6];
+		const char *info = strstr(line, "mm, ");
+		int got_dpi = -1;
+		double scale = 0;
+		if (!records || o >= (int)outputs || strncmp(line, name, strlen(name)) ||
+			(dpi < 0 ? info != NULL :
+			(!info || sscanf(info, "mm, %d DPI, scale %lf", &got_dpi, &scale) != 2 ||
+			got_dpi != dpi || fabs(scale - dpi/96.0) > 0.005))) {
+			fail("journal", "record #%u, output %d (%d DPI): %s", seq, o, dpi, line);
+			break;
+		}
+		++o;
+	}
+	if (!records || seq != iters - 1)
+		fail("journal", "%ld records dumped, last #%u of %ld", records, seq, iters);
+	fclose(dump);
+
+	munmap(journal, sizeof(*journal) + journal->capacity);
+	journal = NULL;
+	unlink(path);
+	free_dpi_info(1);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		rng_state = strtoull(argv[1], NULL, 0) | 1;
+	long scale = argc > 2 ? atol(argv[2]) : 1;
+	if (scale < 1)
+		scale = 1;
+
+	printf("seed %#llx\n", (unsigned long long)rng_state);
+
+	bench_dpi_common(4000000*scale);
+	bench_calc_scaling(4000000*scale);
+	bench_pad_to_int32();
+	bench_xsettings(200000*scale);
+	bench_dpi_index(1000000*scale);
+	bench_journal(100000*scale);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	puts("all checks passed");
+	return 0;
+}
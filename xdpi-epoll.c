@@ -0,0 +1,171 @@
+/* Sample event loop integration of the xdpi asynchronous interface:
+ * print the DPI and scaling changes of outputs and monitors as they happen.
+ * Licensed under the terms of the Mozilla Public License, version 2.
+ * See LICENSE.txt for details.
+ */
+
+/* The interface is included with xdpi.c, with its main renamed out of the
+ * way, as in xdpi-bench.c.
+ *
+ * Usage: ./xdpi-epoll [--snapshots] [--timestamps] [DISPLAY]
+ *
+ * By default, each change is printed; with --snapshots, the scaling factors
+ * of all outputs and monitors are printed after every change. With
+ * --timestamps, each of them is preceded by a line with the wall clock
+ * time in milliseconds since the epoch, and the CPU time used by the
+ * process so far in microseconds: @<ms> <us> (see bench-hotplug.sh).
+ * On exit (e.g. with ^C), the number of dispatch calls and the duration of
+ * the longest one are reported, together with the number of times they
+ * waited for the server, to check that none of them blocked.
+ */
+
+/* For RTLD_NEXT */
+#define _GNU_SOURCE
+#define main xdpi_main
+#include "xdpi.c"
+#undef main
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+/* xcb waits for the server in poll(), which is interposed here to count
+ * the waits that would block during dispatch calls: for a reply (POLLIN
+ * only), or for room in the socket buffer to send requests (POLLOUT too)
+ */
+static Bool dispatching = False;
+static unsigned long reply_waits = 0;
+static unsigned long write_waits = 0;
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	static int (*real_poll)(struct pollfd *, nfds_t, int) = NULL;
+	if (!real_poll)
+		real_poll = (int (*)(struct pollfd *, nfds_t, int))dlsym(RTLD_NEXT, "poll");
+
+	if (dispatching && timeout != 0) {
+		const int ready = real_poll(fds, nfds, 0);
+		if (ready != 0)
+			return ready;
+		Bool writing = False;
+		for (nfds_t k = 0; k < nfds; ++k)
+			writing = writing || (fds[k].events & POLLOUT);
+		++*(writing ? &write_waits : &reply_waits);
+	}
+	return real_poll(fds, nfds, timeout);
+}
+
+static volatile sig_atomic_t quit = 0;
+static Bool timestamps = False;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	quit = 1;
+}
+
+static void on_change(void *data, const struct xdpi_snapshot *snap,
+	const struct xdpi_change *change)
+{
+	static const char *kinds[] = { "added", "removed", "modified" };
+	(void)data;
+
+	if (timestamps) {
+		struct timespec wall, cpu;
+		clock_gettime(CLOCK_REALTIME, &wall);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+		printf("@%lld %lld\n",
+			(long long)wall.tv_sec*1000 + wall.tv_nsec/1000000,
+			(long long)cpu.tv_sec*1000000 + cpu.tv_nsec/1000);
+	}
+
+	if (!change) {
+		/* The same globals as the synchronous passes, for the same report */
+		reference_dpi = snap->reference_dpi;
+		noutput = snap->noutput;
+		output_dpi = snap->output_dpi;
+		nmon = snap->nmon;
+		monitor_dpi = snap->monitor_dpi;
+		print_scaling_factors(stdout, snap->num_screens);
+		reference_dpi = NULL;
+		noutput = nmon = NULL;
+		output_dpi = monitor_dpi = NULL;
+	} else {
+		const struct named_dpi *rec = change->rec;
+		printf("Screen %d: %s %s %s: %dx%d+%d+%d, %d DPI, native ",
+			change->screen, change->monitor ? "monitor" : "output",
+			rec->name, kinds[change->kind],
+			rec->width, rec->height, rec->x, rec->y, rec->dpi);
+		print_scaling_factor(stdout, change->native);
+		fputs(", prorated ", stdout);
+		print_scaling_factor(stdout, change->prorated);
+		fputc('\n', stdout);
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned flags = XDPI_ASYNC_DELTAS;
+	const char *display = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--snapshots"))
+			flags &= ~XDPI_ASYNC_DELTAS;
+		else if (!strcmp(argv[i], "--timestamps"))
+			timestamps = True;
+		else
+			display = argv[i];
+	}
+
+	struct xdpi_async *a = xdpi_async_new(display, flags, on_change, NULL);
+	if (!a) {
+		fputs("Could not open X display\n", stderr);
+		return 1;
+	}
+
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	const int ep = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN };
+	if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, xdpi_async_fd(a), &ev)) {
+		perror("epoll");
+		return 1;
+	}
+
+	int ret = 0;
+	unsigned long calls = 0;
+	double longest = 0;
+	while (!quit) {
+		if (epoll_wait(ep, &ev, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			ret = 1;
+			break;
+		}
+		const double start = now_ms();
+		dispatching = True;
+		const int status = xdpi_async_dispatch(a);
+		dispatching = False;
+		const double elapsed = now_ms() - start;
+		++calls;
+		if (elapsed > longest)
+			longest = elapsed;
+		if (status < 0) {
+			fputs("X connection lost\n", stderr);
+			ret = 1;
+			break;
+		}
+	}
+
+	fprintf(stderr, "%lu dispatch calls, longest: %.3fms\n", calls, longest);
+	fprintf(stderr, "%lu blocking waits for replies, %lu for writes\n",
+		reply_waits, write_waits);
+	close(ep);
+	xdpi_async_free(a);
+	return ret;
+}
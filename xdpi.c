@@ -4,21 +4,39 @@
  * See LICENSE.txt for details.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/select.h>
 
 #include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xresource.h>
 #include <X11/extensions/Xinerama.h>
 #include <X11/extensions/Xrandr.h>
 
 #if WITH_XCB
+#include <pthread.h>
 #include <xcb/xproto.h>
 #include <xcb/xinerama.h>
 #include <xcb/randr.h>
 #include <xcb/xcb_xrm.h>
+#include <xcb/xcbext.h>
+#endif
+
+#if WITH_WAYLAND
+#include <wayland-client.h>
+#include "xdg-output-unstable-v1-client-protocol.h"
 #endif
 
 void error(const char* msg)
@@ -36,6 +54,13 @@ float *reference_dpi;
 struct named_dpi
 {
 	int dpi;
+	Bool primary;
+	/* RR_Connected (zero) unless known otherwise; only for outputs */
+	int connection;
+	/* Position and size in the root window */
+	int x, y, width, height;
+	/* Physical size in mm, following the rotation; only for outputs */
+	int mmw, mmh;
 	char name[STRMAX+1];
 };
 
@@ -47,7 +72,100 @@ struct named_dpi **output_dpi;
 int *nmon;
 struct named_dpi **monitor_dpi;
 
-static int print_dpi_common(int w, int h, int mmw, int mmh)
+/* The RANDR configuration timestamp of each screen, when known
+ * (NULL otherwise)
+ */
+unsigned long *config_time;
+
+/* The number of screens, and the room for records in output_dpi and
+ * monitor_dpi, of DPI information that do_xlib_dpi can reuse (see
+ * alloc_dpi_info)
+ */
+int dpi_info_screens;
+int *output_cap;
+int *monitor_cap;
+
+/* Query selection: when a screen, output or monitor is selected,
+ * only the requests needed to answer for it are sent, and only the
+ * selected records are shown.
+ */
+struct selection
+{
+	int screen; /* -1 for all screens */
+	const char *output;
+	const char *monitor;
+	int found; /* number of selected records found */
+
+	/* Look up the DPI at a given point, or under a given window */
+	Bool at;
+	int x, y;
+	unsigned long window;
+};
+
+struct selection sel = { .screen = -1 };
+
+/* Are we only interested in specific outputs or monitors? */
+static inline Bool targeted_query(void)
+{
+	return sel.output || sel.monitor;
+}
+
+static inline Bool screen_selected(int i)
+{
+	return sel.screen < 0 || sel.screen == i;
+}
+
+/* Outputs are of interest if they were selected, or if no specific
+ * monitor was selected
+ */
+static inline Bool want_outputs(void)
+{
+	return sel.output || !sel.monitor;
+}
+
+static inline Bool want_monitors(void)
+{
+	return sel.monitor || !sel.output;
+}
+
+static Bool output_selected(const char *name)
+{
+	if (sel.output)
+		return name && !strcmp(sel.output, name);
+	return !sel.monitor;
+}
+
+static Bool monitor_selected(const char *name)
+{
+	if (sel.monitor)
+		return name && !strcmp(sel.monitor, name);
+	return !sel.output;
+}
+
+/* Print to the report stream. A NULL stream is used when the information
+ * is needed (e.g. the primary output DPI for prorated scaling) but the
+ * record itself was not selected for display.
+ */
+static void report(FILE *out, const char *fmt, ...)
+{
+	if (!out)
+		return;
+
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(out, fmt, ap);
+	va_end(ap);
+}
+
+/* Monotonic time in milliseconds */
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000.0 + ts.tv_nsec/1.0e6;
+}
+
+static int print_dpi_common(FILE *out, int w, int h, int mmw, int mmh)
 {
 	double pitch = hypot(mmw, mmh)/hypot(w, h);
 
@@ -64,54 +182,66 @@ static int print_dpi_common(int w, int h, int mmw, int mmh)
 		ydpcm = (int)round(h*10.0/mmh);
 	}
 
-	printf("%dx%d dpi, %dx%d dpcm, dot pitch %.2gmm\n",
+	report(out, "%dx%d dpi, %dx%d dpcm, dot pitch %.2gmm\n",
 		xdpi, ydpi, xdpcm, ydpcm, pitch);
 
 	return ydpi ? ydpi : xdpi;
 }
 
-static int print_dpi_screen(int i, int width, int height, int mmw, int mmh)
+static int print_dpi_screen(FILE *out, int i, int width, int height, int mmw, int mmh)
 {
-	printf("Screen %d: %dx%d pixels, %dx%d mm: ", i, width, height, mmw, mmh);
-	return print_dpi_common(width, height, mmw, mmh);
+	report(out, "Screen %d: %dx%d pixels, %dx%d mm: ", i, width, height, mmw, mmh);
+	return print_dpi_common(out, width, height, mmw, mmh);
 }
 
-static int print_dpi_randr(const char *name,
-	unsigned long mmw, unsigned long mmh, int w, int h,
-	int rotated, int primary, int connection)
+static const char *connection_name(int connection)
 {
-	const char * connection_string = (connection == RR_Connected ?
+	return (connection == RR_Connected ?
 		"connected" : (connection == RR_Disconnected ?
 			"disconnected" : (connection == RR_UnknownConnection ?
 				"unknown" : "?")));
-	printf("\t\t%s (%s%s, %s): %dx%d pixels, %lux%lu mm: ",
+}
+
+static int print_dpi_randr(FILE *out, const char *name,
+	unsigned long mmw, unsigned long mmh, int w, int h,
+	int rotated, int primary, int connection)
+{
+	const char * connection_string = connection_name(connection);
+	report(out, "\t\t%s (%s%s, %s): %dx%d pixels, %lux%lu mm: ",
 		name ? name : "<error>",
 		(rotated ? "R" : "U"),
 		(primary ? ", primary" : ""),
 		connection_string,
 		w, h,
 		mmw, mmh);
-	return print_dpi_common(w, h, mmw, mmh);
-}
-
-static int print_dpi_monitor(const char *name, int width, int height, int mmw, int mmh, Bool prim, Bool automatic)
-{
-	/* TODO FIXME the monitor interface does not provide a way to tell if
-	 * the monitor is rotated or not. A possible way to determine this
-	 * would be to fetch the associated outputs and check if any/all are
-	 * rotated. This requires multiple roundtrips, and one is left to
-	 * wonder what should be done if one of the outputs is rotated
-	 * and the other is not. Pending further clarifications on the matter,
-	 * we determine if the output is rotated or not simply by comparing
-	 * the relative magnitude of width/height with that of mmw/mmh;
-	 * the only cases in which this should fail is for outputs that
-	 * are either massively anamorphic, or report completely random
-	 * numbers (rather than bogus but “reasonable” numbers such
-	 * as 16mm and 9mm for a projector with 16:9 aspect ratio) as
-	 * physical dimensions.
+	return print_dpi_common(out, w, h, mmw, mmh);
+}
+
+/* Outputs without a CRTC have no geometry, and are only shown when
+ * selected with --output
+ */
+static void print_inactive_output(FILE *out, const char *name, int connection)
+{
+	report(out, "\t\t%s (%s): no CRTC\n", name, connection_name(connection));
+}
+
+static int print_dpi_monitor(FILE *out, const char *name, int width, int height, int mmw, int mmh,
+	int rotated, Bool prim, Bool automatic)
+{
+	/* The monitor interface does not tell if the monitor is rotated or
+	 * not. When the CRTCs of its outputs were fetched anyway, rotated
+	 * is taken from them (see fold_rotation); it is negative when they
+	 * are unknown or disagree. In that case, we determine if the monitor
+	 * is rotated or not simply by comparing the relative magnitude of
+	 * width/height with that of mmw/mmh; the only cases in which this
+	 * should fail is for outputs that are either massively anamorphic,
+	 * or report completely random numbers (rather than bogus but
+	 * “reasonable” numbers such as 16mm and 9mm for a projector with 16:9
+	 * aspect ratio) as physical dimensions.
 	 */
 
-	const int rotated = ((width > height) != (mmw > mmh));
+	if (rotated < 0)
+		rotated = ((width > height) != (mmw > mmh));
 	if (rotated) {
 		int t = mmw;
 		mmw = mmh;
@@ -124,10 +254,10 @@ static int print_dpi_monitor(const char *name, int width, int height, int mmw, i
 		(prim ? ", primary" : ""),
 		(automatic ? ", automatic" : ""));
 
-	printf("\t\t%s%s: %dx%d pixels, %dx%d mm: ",
+	report(out, "\t\t%s%s: %dx%d pixels, %dx%d mm: ",
 		name ? name : "<error>",
 		info, width, height, mmw, mmh);
-	return print_dpi_common(width, height, mmw, mmh);
+	return print_dpi_common(out, width, height, mmw, mmh);
 }
 
 /*
@@ -153,77 +283,364 @@ int pad_to_int32(int n) {
 	return (n + 3) & (~3);
 }
 
-Bool xsettings_find_xft_dpi(unsigned char *buffer, unsigned int scrnum, Bool printed_xset_hdr)
+/* Read a CARD16 or CARD32 from XSETTINGS data, swapping the bytes
+ * if the data is not in our native byte order
+ */
+static uint16_t xsettings_card16(const unsigned char *p, Bool swap)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return swap ? (uint16_t)((v >> 8) | (v << 8)) : v;
+}
+
+static uint32_t xsettings_card32(const unsigned char *p, Bool swap)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return swap ? ((v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24)) : v;
+}
+
+/* Byte order marker for XSETTINGS data in our native byte order */
+static unsigned char xsettings_native_byte_order(void)
+{
+	const uint16_t probe = 1;
+	return *(const unsigned char*)&probe ? LSBFirst : MSBFirst;
+}
+
+/* Size of the XSETTINGS entry at buffer, or 0 if the entry is malformed
+ * or does not fit in the avail bytes left in the buffer
+ */
+static size_t xsettings_entry_size(const unsigned char *buffer, size_t avail, Bool swap)
+{
+	if (avail < 4)
+		return 0;
+
+	size_t name_len = xsettings_card16(buffer + 2, swap);
+	/* Header, name, and serial */
+	size_t size = 4 + pad_to_int32(name_len) + 4;
+	if (size > avail)
+		return 0;
+
+	switch (buffer[0]) {
+	case XSETTINGS_TYPE_INT:
+		size += 4;
+		break;
+	case XSETTINGS_TYPE_COLOR:
+		size += 8;
+		break;
+	case XSETTINGS_TYPE_STRING:
+		if (size + 4 > avail)
+			return 0;
+		size_t value_len = xsettings_card32(buffer + size, swap);
+		if (value_len > avail)
+			return 0;
+		size += 4 + ((value_len + 3) & ~(size_t)3);
+		break;
+	default:
+		return 0;
+	}
+
+	return size > avail ? 0 : size;
+}
+
+#define XSETTINGS_NOT_FOUND 0
+#define XSETTINGS_FOUND 1
+#define XSETTINGS_MALFORMED -1
+#define XSETTINGS_WRONG_TYPE -2
+
+/* Look for Xft/DPI in the len bytes of XSETTINGS data at buffer,
+ * storing its value (in 1024ths of a DPI) in xft_dpi if found
+ */
+static int xsettings_parse_xft_dpi(const unsigned char *buffer, size_t len, int32_t *xft_dpi)
 {
-	/* TODO check byte order */
-	uint32_t num_settings = ((uint32_t*)buffer)[2];
+	static const char xft_dpi_name[] = "Xft/DPI";
+	const size_t xft_dpi_name_len = sizeof(xft_dpi_name) - 1;
 
-	/* Skip rest of header */
-	buffer += 12;
+	if (len < 12 || (buffer[0] != LSBFirst && buffer[0] != MSBFirst))
+		return XSETTINGS_MALFORMED;
+
+	const Bool swap = buffer[0] != xsettings_native_byte_order();
+	uint32_t num_settings = xsettings_card32(buffer + 8, swap);
+
+	/* Skip the header */
+	const unsigned char *entry = buffer + 12;
+	size_t avail = len - 12;
 
 	while (num_settings-- > 0) {
-		int type = buffer[0];
-		int name_len = *(uint16_t*)(buffer + 2);
-		char *name = malloc(name_len+1);
-		if (!name) error("out of memory for Xft.dpi");
-
-		memcpy(name, buffer + 4, name_len);
-		name[name_len] = '\0';
-		/* Skip header, name, and serial to actual data */
-		buffer += 4 + pad_to_int32(name_len) + 4;
-
-		/* Check the name now */
-		if (strcmp(name, "Xft/DPI")) {
-			free(name);
-			/* Not Xft/DPI, skip and continue */
-			switch (type) {
-			case XSETTINGS_TYPE_INT:
-				buffer += 4;
-				break;
-			case XSETTINGS_TYPE_COLOR:
-				buffer += 8;
-				break;
-			case XSETTINGS_TYPE_STRING:
-				name_len = *(uint32_t*)buffer;
-				buffer += 4 + pad_to_int32(name_len);
+		const size_t size = xsettings_entry_size(entry, avail, swap);
+		if (!size)
+			return XSETTINGS_MALFORMED;
+
+		const size_t name_len = xsettings_card16(entry + 2, swap);
+		if (name_len == xft_dpi_name_len && !memcmp(entry + 4, xft_dpi_name, name_len)) {
+			if (entry[0] != XSETTINGS_TYPE_INT)
+				return XSETTINGS_WRONG_TYPE;
+			/* Skip header, name, and serial to actual data */
+			*xft_dpi = (int32_t)xsettings_card32(entry + 4 + pad_to_int32(name_len) + 4, swap);
+			return XSETTINGS_FOUND;
+		}
+
+		entry += size;
+		avail -= size;
+	}
+	return XSETTINGS_NOT_FOUND;
+}
+
+Bool xsettings_find_xft_dpi(FILE *out, const unsigned char *buffer, size_t len,
+	unsigned int scrnum, Bool printed_xset_hdr)
+{
+	int32_t xft_dpi = 0;
+	switch (xsettings_parse_xft_dpi(buffer, len, &xft_dpi)) {
+	case XSETTINGS_MALFORMED:
+		fprintf(stderr, "XSETTINGS/Screen %d: malformed settings\n", scrnum);
+		break;
+	case XSETTINGS_WRONG_TYPE:
+		fprintf(stderr, "\tScreen %d: Xft/DPI has wrong type\n", scrnum);
+		break;
+	case XSETTINGS_FOUND:
+		if (!printed_xset_hdr) {
+			report(out, "XSETTINGS:\n");
+			printed_xset_hdr = True;
+		}
+		report(out, "\tScreen %d:\n\t\tXft/DPI: %8g\t(%d/1024)\n", scrnum, xft_dpi/1024.0, xft_dpi);
+		break;
+	}
+	return printed_xset_hdr;
+}
+
+/* Build new XSETTINGS data with the given serial and Xft/DPI value,
+ * preserving all other settings from the (optional) old data.
+ * Returns a newly allocated buffer, whose size is stored in len.
+ */
+static unsigned char *xsettings_set_xft_dpi(const unsigned char *old, size_t old_len,
+	uint32_t serial, int dpi, size_t *len)
+{
+	static const char xft_dpi_name[] = "Xft/DPI";
+	const size_t xft_dpi_name_len = sizeof(xft_dpi_name) - 1;
+	const size_t xft_dpi_size = 4 + pad_to_int32(xft_dpi_name_len) + 4 + 4;
+
+	/* Settings in a foreign byte order are dropped rather than converted */
+	if (old && (old_len < 12 || old[0] != xsettings_native_byte_order()))
+		old = NULL;
+
+	unsigned char *buffer = calloc(12 + (old ? old_len - 12 : 0) + xft_dpi_size, 1);
+	if (!buffer) error("out of memory for XSETTINGS");
+
+	uint32_t num_settings = 0;
+	size_t pos = 12;
+
+	if (old) {
+		uint32_t num_old = ((const uint32_t*)old)[2];
+		const unsigned char *entry = old + 12;
+		size_t avail = old_len - 12;
+		while (num_old-- > 0) {
+			size_t size = xsettings_entry_size(entry, avail, False);
+			if (!size) {
+				fputs("XSETTINGS: dropping malformed settings\n", stderr);
 				break;
 			}
-			continue;
-		} else {
-			free(name);
-			/* Oh, found Xft/DPI */
-			if (!printed_xset_hdr) {
-				puts("XSETTINGS:");
-				printed_xset_hdr = True;
-			}
-			if (type != XSETTINGS_TYPE_INT) {
-				fprintf(stderr, "\tScreen %d: Xft/DPI has wrong type\n", scrnum);
-			} else {
-				int xft_dpi = *(uint32_t*)buffer;
-				printf("\tScreen %d:\n\t\tXft/DPI: %8g\t(%d/1024)\n", scrnum, xft_dpi/1024.0, xft_dpi);
+			const size_t name_len = *(uint16_t*)(entry + 2);
+			const Bool is_xft_dpi = name_len == xft_dpi_name_len &&
+				!memcmp(entry + 4, xft_dpi_name, xft_dpi_name_len);
+			if (!is_xft_dpi) {
+				memcpy(buffer + pos, entry, size);
+				pos += size;
+				++num_settings;
 			}
-			break;
+			entry += size;
+			avail -= size;
 		}
 	}
-	return printed_xset_hdr;
+
+	/* Append our Xft/DPI */
+	buffer[pos] = XSETTINGS_TYPE_INT;
+	*(uint16_t*)(buffer + pos + 2) = xft_dpi_name_len;
+	memcpy(buffer + pos + 4, xft_dpi_name, xft_dpi_name_len);
+	pos += 4 + pad_to_int32(xft_dpi_name_len);
+	*(uint32_t*)(buffer + pos) = serial; /* last change serial */
+	*(int32_t*)(buffer + pos + 4) = dpi*1024;
+	pos += 8;
+	++num_settings;
+
+	buffer[0] = xsettings_native_byte_order();
+	((uint32_t*)buffer)[1] = serial;
+	((uint32_t*)buffer)[2] = num_settings;
+
+	*len = pos;
+	return buffer;
+}
+
+/*
+ * Resource ID lookups
+ */
+
+/* Open addressing hash table mapping X resource IDs (CRTCs, modes) to their
+ * index in the lists returned by the server, so that joining outputs to their
+ * CRTC and CRTCs to their mode takes linear rather than quadratic time with
+ * thousands of them. IDs are never zero (None), which marks empty slots.
+ */
+struct xid_index
+{
+	uint32_t *ids;
+	int *pos;
+	uint32_t mask;
+};
+
+static void xid_index_init(struct xid_index *idx, int count)
+{
+	uint32_t size = 16;
+	while (size < 2u*count)
+		size *= 2;
+	idx->ids = calloc(size, sizeof(*idx->ids));
+	idx->pos = malloc(size*sizeof(*idx->pos));
+	if (!idx->ids || !idx->pos)
+		error("out of memory for resource index");
+	idx->mask = size - 1;
+}
+
+/* Multiplying by an odd constant spreads the (mostly sequential) IDs
+ * without collisions in the low bits */
+static inline uint32_t xid_slot(const struct xid_index *idx, uint32_t id)
+{
+	return (id*2654435761u) & idx->mask;
+}
+
+static void xid_index_add(struct xid_index *idx, uint32_t id, int pos)
+{
+	if (!id)
+		return;
+	uint32_t slot = xid_slot(idx, id);
+	while (idx->ids[slot] && idx->ids[slot] != id)
+		slot = (slot + 1) & idx->mask;
+	/* Keep the first occurrence */
+	if (!idx->ids[slot]) {
+		idx->ids[slot] = id;
+		idx->pos[slot] = pos;
+	}
+}
+
+/* Position of the given ID, or -1 if not found */
+static int xid_index_find(const struct xid_index *idx, uint32_t id)
+{
+	if (!id)
+		return -1;
+	for (uint32_t slot = xid_slot(idx, id); idx->ids[slot]; slot = (slot + 1) & idx->mask)
+		if (idx->ids[slot] == id)
+			return idx->pos[slot];
+	return -1;
+}
+
+static void xid_index_free(struct xid_index *idx)
+{
+	free(idx->ids);
+	free(idx->pos);
+	idx->ids = NULL;
+	idx->pos = NULL;
+}
+
+/* Rotation of the outputs of a screen whose CRTC is known, indexed by
+ * output ID, to join monitors to the outputs they are made of
+ */
+struct output_rotations
+{
+	struct xid_index index;
+	signed char *rotated;
+};
+
+static void output_rotations_init(struct output_rotations *r, int count)
+{
+	xid_index_init(&r->index, count);
+	r->rotated = malloc(count + 1);
+	if (!r->rotated)
+		error("out of memory for output rotations");
+}
+
+static void output_rotations_set(struct output_rotations *r, uint32_t output, int pos, int rotated)
+{
+	xid_index_add(&r->index, output, pos);
+	r->rotated[pos] = rotated;
+}
+
+/* Fold the rotation of one of the outputs of a monitor into that of the
+ * monitor: starting from -1 (unknown), the result stays 0 or 1 while the
+ * outputs with a known rotation agree, and becomes -2 once they disagree
+ */
+static int fold_rotation(int rotated, const struct output_rotations *r, uint32_t output)
+{
+	const int o = r->rotated ? xid_index_find(&r->index, output) : -1;
+	if (o < 0 || rotated == r->rotated[o] || rotated == -2)
+		return rotated;
+	return rotated == -1 ? r->rotated[o] : -2;
+}
+
+static void output_rotations_free(struct output_rotations *r)
+{
+	xid_index_free(&r->index);
+	free(r->rotated);
+	r->rotated = NULL;
 }
 
 /*
  * Xlib DPI info extraction
  */
 
-static int do_xlib_dpi(Display *disp)
+/* Set when we listen for RANDR change notifications, so that we can
+ * use the current screen resources instead of polling the hardware
+ */
+Bool randr_notified = False;
+
+/* Allocate the DPI information for num_screens. When it was not freed
+ * since the previous pass on the same display (e.g. between metrics
+ * snapshots), it is cleared and reused instead, together with the records
+ * (see dpi_list)
+ */
+static void alloc_dpi_info(int num_screens)
 {
-	int num_screens = ScreenCount(disp);
+	if (reference_dpi && dpi_info_screens == num_screens) {
+		memset(reference_dpi, 0, num_screens*sizeof(*reference_dpi));
+		memset(noutput, 0, num_screens*sizeof(*noutput));
+		memset(nmon, 0, num_screens*sizeof(*nmon));
+		memset(config_time, 0, num_screens*sizeof(*config_time));
+		return;
+	}
 
 	reference_dpi = calloc(num_screens, sizeof(*reference_dpi));
 	noutput = calloc(num_screens, sizeof(*noutput));
 	nmon = calloc(num_screens, sizeof(*nmon));
 	output_dpi = calloc(num_screens, sizeof(*output_dpi));
 	monitor_dpi = calloc(num_screens, sizeof(*monitor_dpi));
+	config_time = calloc(num_screens, sizeof(*config_time));
+	output_cap = calloc(num_screens, sizeof(*output_cap));
+	monitor_cap = calloc(num_screens, sizeof(*monitor_cap));
 
-	if (!reference_dpi || !noutput || !nmon || !output_dpi || !monitor_dpi)
+	if (!reference_dpi || !noutput || !nmon || !output_dpi || !monitor_dpi || !config_time ||
+		!output_cap || !monitor_cap)
 		error("out of memory during Xlib DPI informaion retrieval");
+	dpi_info_screens = num_screens;
+}
+
+/* Room for count cleared records, reusing the list (with room for *cap)
+ * if it is large enough
+ */
+static struct named_dpi *dpi_list(struct named_dpi *list, int *cap, int count)
+{
+	if (list && *cap >= count) {
+		memset(list, 0, count*sizeof(*list));
+		return list;
+	}
+	free(list);
+	list = calloc(count + 1, sizeof(*list));
+	if (!list)
+		error("out of memory for output and monitor DPI");
+	*cap = count;
+	return list;
+}
+
+static int do_xlib_dpi(FILE *out, Display *disp)
+{
+	int num_screens = ScreenCount(disp);
+
+	alloc_dpi_info(num_screens);
 
 	int scratch = 0;
 	const Bool has_randr = XRRQueryExtension(disp, &scratch, &scratch);
@@ -236,10 +653,21 @@ static int do_xlib_dpi(Display *disp)
 		has_randr_monitor = (rr_major > 1 || rr_minor >= 5);
 	}
 
+	/* When looking for a specific monitor, we only need to compare the
+	 * monitor name atoms, rather than fetching the name of every monitor
+	 */
+	Atom sel_monitor_atom = None;
+	if (sel.monitor && has_randr_monitor)
+		sel_monitor_atom = XInternAtom(disp, sel.monitor, True);
+
 	/* Iterate over all screens, and show X11 and XRandR information */
 	for (int i = 0 ; i < num_screens ; ++i) {
+		if (!screen_selected(i))
+			continue;
+
 		Screen *screen = ScreenOfDisplay(disp, i);
 		Window root_win = RootWindowOfScreen(screen);
+		struct output_rotations rotations = { .rotated = NULL };
 
 		/* Standard X11 information */
 		{
@@ -249,29 +677,39 @@ static int do_xlib_dpi(Display *disp)
 			int mmw = WidthMMOfScreen(screen);
 			int mmh = HeightMMOfScreen(screen);
 
-			reference_dpi[i] = print_dpi_screen(i, width, height, mmw, mmh);
+			reference_dpi[i] = print_dpi_screen(targeted_query() ? NULL : out,
+				i, width, height, mmw, mmh);
 		}
 
 		if (!has_randr)
 			continue;
 
+		/* Monitors alone do not need the screen resources */
+		if (!want_outputs())
+			goto monitors;
+
 		/* XRandR information */
-		XRRScreenResources *xrr_res = XRRGetScreenResources(disp, root_win);
+		/* When we get notified about changes, we do not need the server
+		 * to poll the hardware */
+		XRRScreenResources *xrr_res = (randr_notified && has_randr_primary) ?
+			XRRGetScreenResourcesCurrent(disp, root_win) :
+			XRRGetScreenResources(disp, root_win);
 
 		if (!xrr_res)
 			continue; /* no XRR resources */
+		config_time[i] = xrr_res->configTimestamp;
 
-		printf("\tXRandR (%d.%d):\n", rr_major, rr_minor);
+		if (!targeted_query())
+			report(out, "\tXRandR (%d.%d):\n", rr_major, rr_minor);
 
 		RROutput primary = -1;
 		if (has_randr_primary)
 			primary = XRRGetOutputPrimary(disp, root_win);
 
-		output_dpi[i] = calloc(
-			(noutput[i] = xrr_res->noutput),
-			sizeof(**output_dpi));
-		if (!output_dpi[i])
-			error("out of memory for output DPI");
+		output_dpi[i] = dpi_list(output_dpi[i], output_cap + i,
+			(noutput[i] = xrr_res->noutput));
+
+		output_rotations_init(&rotations, xrr_res->noutput);
 
 		/* iterate over all outputs, and compute the DPIs from the connected CRTC */
 		for (int o = 0; o < xrr_res->noutput; ++o) {
@@ -282,8 +720,27 @@ static int do_xlib_dpi(Display *disp)
 			 * if it turns out to be connected. An output with negative dpi will
 			 * be skipped when printing scaling factors */
 			output_dpi[i][o].dpi = -1;
+			output_dpi[i][o].connection = rro->connection;
+			strncpy(output_dpi[i][o].name, rro->name, STRMAX);
+
+			/* Outputs without a CRTC (e.g. disconnected ones) are only
+			 * recorded for their connection state */
+			if (!rro->crtc) {
+				if (sel.output && output_selected(rro->name)) {
+					print_inactive_output(out, rro->name, rro->connection);
+					++sel.found;
+				}
+				XRRFreeOutputInfo(rro);
+				continue;
+			}
+
+			const Bool is_primary = xrr_res->outputs[o] == primary;
+			const Bool selected = output_selected(rro->name);
 
-			if (rro->crtc) {
+			/* Unselected outputs are only of interest if they are the primary
+			 * (for the prorated scaling)
+			 */
+			if (selected || is_primary) {
 				XRRCrtcInfo *rrc = XRRGetCrtcInfo(disp, xrr_res, rro->crtc);
 				if (!rrc) error("XRRGetCrtcInfo failed");
 
@@ -296,10 +753,24 @@ static int do_xlib_dpi(Display *disp)
 				unsigned long mmw = rotated ? rro->mm_height : rro->mm_width;
 				unsigned long mmh = rotated ? rro->mm_width : rro->mm_height;
 
-				strncpy(output_dpi[i][o].name, rro->name, STRMAX);
-				output_dpi[i][o].dpi = print_dpi_randr(rro->name, mmw, mmh, w, h,
-					rotated, xrr_res->outputs[o] == primary,
+				output_rotations_set(&rotations, xrr_res->outputs[o], o, rotated);
+				output_dpi[i][o].primary = is_primary;
+				output_dpi[i][o].x = rrc->x;
+				output_dpi[i][o].y = rrc->y;
+				output_dpi[i][o].width = w;
+				output_dpi[i][o].height = h;
+				output_dpi[i][o].mmw = mmw;
+				output_dpi[i][o].mmh = mmh;
+				output_dpi[i][o].dpi = print_dpi_randr(selected ? out : NULL,
+					rro->name, mmw, mmh, w, h,
+					rotated, is_primary,
 					rro->connection);
+				/* The CRTC transform and panning are only shown by
+				 * the xcb passes, which fetch them in the same batch as
+				 * the CRTC information, while here they would cost a
+				 * round trip each */
+				if (selected && sel.output)
+					++sel.found;
 
 				XRRFreeCrtcInfo(rrc);
 			}
@@ -307,46 +778,96 @@ static int do_xlib_dpi(Display *disp)
 		}
 		XRRFreeScreenResources(xrr_res);
 
-		/* Monitors were introduced in RANDR 1.5 */
-		if (has_randr_monitor) {
+monitors:
+		/* Monitors were introduced in RANDR 1.5, and the selected one
+		 * may not exist on the server */
+		if (has_randr_monitor && want_monitors() &&
+			!(sel.monitor && sel_monitor_atom == None)) {
 			XRRMonitorInfo *monitors = XRRGetMonitors(disp, root_win, True, nmon + i);
 			if (!monitors) error("XRRGetMonitors failed");
 			if (nmon[i] > 0) {
-				puts("\tMonitors:");
-				monitor_dpi[i] = calloc(nmon[i], sizeof(**monitor_dpi));
-				if (!monitor_dpi[i])
-					error("out of memory for monitor DPI");
+				if (!targeted_query())
+					report(out, "\tMonitors:\n");
+				monitor_dpi[i] = dpi_list(monitor_dpi[i], monitor_cap + i, nmon[i]);
+
+				/* Fetch all the monitor names at once, rather than with
+				 * a round trip per monitor */
+				char **names = NULL;
+				if (!sel.monitor) {
+					Atom *atoms = malloc(nmon[i]*sizeof(*atoms));
+					names = calloc(nmon[i], sizeof(*names));
+					if (!atoms || !names)
+						error("out of memory for monitor names");
+					for (int m = 0; m < nmon[i]; ++m)
+						atoms[m] = monitors[m].name;
+					if (!XGetAtomNames(disp, atoms, nmon[i], names))
+						memset(names, 0, nmon[i]*sizeof(*names));
+					free(atoms);
+				}
 
 				XRRMonitorInfo *mon = monitors;
 				for (int m = 0; m < nmon[i]; ++m, ++mon) {
 					/* Note that width/height follow the monitor rotation,
 					 * but mwidth/mheight don't!
 					 */
-					char *name = XGetAtomName(disp, mon->name);
-					strncpy(monitor_dpi[i][m].name, name, STRMAX);
-					monitor_dpi[i][m].dpi = print_dpi_monitor(name,
+					const Bool selected = sel.monitor ?
+						mon->name == sel_monitor_atom : monitor_selected(NULL);
+					monitor_dpi[i][m].primary = mon->primary;
+					monitor_dpi[i][m].x = mon->x;
+					monitor_dpi[i][m].y = mon->y;
+					monitor_dpi[i][m].width = mon->width;
+					monitor_dpi[i][m].height = mon->height;
+					int rotated = -1;
+					for (int k = 0; k < mon->noutput; ++k)
+						rotated = fold_rotation(rotated, &rotations, mon->outputs[k]);
+					/* Besides the selected one, we only need the DPI of the
+					 * primary monitor, and not its name */
+					char *name = names ? names[m] : NULL;
+					if (!selected) {
+						monitor_dpi[i][m].dpi = print_dpi_monitor(NULL, NULL,
+							mon->width, mon->height,
+							mon->mwidth, mon->mheight, rotated,
+							mon->primary, mon->automatic);
+						if (name)
+							XFree(name);
+						continue;
+					}
+					const char *shown = sel.monitor ? sel.monitor : name;
+					strncpy(monitor_dpi[i][m].name, shown ? shown : "<error>", STRMAX);
+					monitor_dpi[i][m].dpi = print_dpi_monitor(out, shown,
 						mon->width, mon->height,
-						mon->mwidth, mon->mheight,
+						mon->mwidth, mon->mheight, rotated,
 						mon->primary, mon->automatic);
-					free(name);
+					if (sel.monitor)
+						++sel.found;
+					if (name)
+						XFree(name);
 				}
+				free(names);
 			}
 			XRRFreeMonitors(monitors);
 		}
+		output_rotations_free(&rotations);
 	}
 
+	/* Xinerama spans all screens and has no DPI information, so it is
+	 * skipped (together with XSETTINGS) for targeted queries, and when
+	 * nothing is being reported
+	 */
+	const Bool whole_report = out && !targeted_query() && sel.screen < 0;
+
 	/* Xinerama */
 
-	Bool xine_p = XineramaIsActive(disp);
+	Bool xine_p = whole_report && XineramaIsActive(disp);
 	if (xine_p) {
 		int num_xines = 0;
 		XineramaScreenInfo *xines = XineramaQueryScreens(disp, &num_xines);
 		if (xines) {
-			puts("Xinerama screens:");
+			report(out, "Xinerama screens:\n");
 			for (int i = 0; i < num_xines; ++i) {
 				XineramaScreenInfo *xi = xines + i;
 				int n = xi->screen_number;
-				printf("\t%u: %ux%u pixels, no dpi information\n",
+				report(out, "\t%u: %ux%u pixels, no dpi information\n",
 					n,
 					xi->width,
 					xi->height);
@@ -358,13 +879,21 @@ static int do_xlib_dpi(Display *disp)
 	/* Xft.dpi */
 
 	for (int i = 0; i < num_screens; ++i) {
+		if (!screen_selected(i))
+			continue;
 
 		/* Xft.dpi */
+		/* Xlib loads the resource database on connection, so this needs
+		 * no roundtrip, and we do it for targeted queries too since it
+		 * affects the reference DPI
+		 */
 		const char *dpi = XGetDefault(disp, "Xft", "dpi");
 		if (dpi) {
 			float xft_dpi;
-			puts("X resources:");
-			printf("\tXft.dpi: %s\n", dpi);
+			if (!targeted_query()) {
+				report(out, "X resources:\n");
+				report(out, "\tXft.dpi: %s\n", dpi);
+			}
 			xft_dpi = strtof(dpi, NULL);
 			/* Override core DPI only if valid */
 			if (xft_dpi > 0)
@@ -374,7 +903,7 @@ static int do_xlib_dpi(Display *disp)
 
 	/* XSETTINGS */
 
-	{
+	if (whole_report) {
 		char *xsettings_names = calloc(
 			xsettings_name_offset*(num_screens + 1),
 			sizeof(char));
@@ -389,7 +918,7 @@ static int do_xlib_dpi(Display *disp)
 				"_XSETTINGS_S%d", i);
 		}
 		xsettings_name[num_screens] = xsettings_names + num_screens*xsettings_name_offset;
-		memcpy(xsettings_name[num_screens], xsettings_settings, xsettings_name_offset);
+		strncpy(xsettings_name[num_screens], xsettings_settings, xsettings_max_name_len);
 		XInternAtoms(disp, xsettings_name, num_screens + 1, True, xsettings_atom);
 
 		/* If all Atoms are None, XSETTINGS was never used on this server */
@@ -443,7 +972,7 @@ static int do_xlib_dpi(Display *disp)
 			if (nitems == 0)
 				continue; /* No settings, hence no Xft/DPI */
 
-			printed_xset_hdr = xsettings_find_xft_dpi(buffer, i, printed_xset_hdr);
+			printed_xset_hdr = xsettings_find_xft_dpi(out, buffer, nitems, i, printed_xset_hdr);
 
 			XFree(buffer);
 
@@ -459,9 +988,9 @@ static int do_xlib_dpi(Display *disp)
 	return num_screens;
 }
 
-static int xlib_dpi(void)
+static int xlib_dpi(FILE *out)
 {
-	puts("** Xlib interfaces");
+	report(targeted_query() ? NULL : out, "** Xlib interfaces\n");
 
 	Display *disp = XOpenDisplay(getenv("DISPLAY"));
 	if (!disp) {
@@ -469,7 +998,7 @@ static int xlib_dpi(void)
 		return 0;
 	}
 
-	int num_screens = do_xlib_dpi(disp);
+	int num_screens = do_xlib_dpi(out, disp);
 
 	XCloseDisplay(disp);
 
@@ -477,7 +1006,73 @@ static int xlib_dpi(void)
 }
 
 #if WITH_XCB
-static void do_xcb_dpi(xcb_connection_t *conn)
+/* The CRTC size reported by RANDR is the area of the framebuffer it scans out,
+ * i.e. the size of its mode with the CRTC transform (e.g. xrandr --scale)
+ * applied, so the DPI computed from it is the effective DPI, in the framebuffer
+ * pixels applications draw in, and it is the one used for the scaling factors.
+ * When the mode is scaled, also show the scale and the DPI of the panel itself.
+ * Sizes and scales follow the rotation of the CRTC.
+ */
+static void print_crtc_transform(FILE *out, double sx, double sy,
+	int mode_w, int mode_h, unsigned long mmw, unsigned long mmh)
+{
+	if (fabs(sx - 1) < 1e-3 && fabs(sy - 1) < 1e-3)
+		return;
+	report(out, "\t\t\tscaled %.3gx%.3g from %dx%d mode, panel: ",
+		sx, sy, mode_w, mode_h);
+	print_dpi_common(out, mode_w, mode_h, mmw, mmh);
+}
+
+/* With panning, the CRTC scrolls over a larger area of the framebuffer,
+ * which is then the area covered by the output
+ */
+static void print_crtc_panning(FILE *out, int left, int top, int width, int height)
+{
+	report(out, "\t\t\tpanning over %dx%d+%d+%d\n", width, height, left, top);
+}
+
+/* Show the scale and panning of a CRTC, if any. The transform and panning
+ * replies are optional (they require RANDR 1.3). Returns the panning reply,
+ * if panning is active
+ */
+static const xcb_randr_get_panning_reply_t *xcb_print_crtc_extras(FILE *out,
+	const xcb_randr_get_crtc_info_reply_t *rrc,
+	const xcb_randr_get_crtc_transform_reply_t *transform,
+	const xcb_randr_get_panning_reply_t *panning,
+	const xcb_randr_mode_info_t *mode,
+	int rotated, uint32_t mmw, uint32_t mmh)
+{
+	int mode_w = 0, mode_h = 0;
+	if (mode) {
+		mode_w = rotated ? mode->height : mode->width;
+		mode_h = rotated ? mode->width : mode->height;
+	}
+
+	if (mode_w && mode_h) {
+		double sx = (double)rrc->width/mode_w;
+		double sy = (double)rrc->height/mode_h;
+		/* For plain scaling transforms, show the exact scale that was set,
+		 * rather than the one that results from the rounded CRTC size.
+		 * Transform entries are 16.16 fixed point numbers */
+		const xcb_render_transform_t *t = transform ? &transform->current_transform : NULL;
+		if (t && !t->matrix12 && !t->matrix21 && !t->matrix31 && !t->matrix32 &&
+			t->matrix33 == 0x10000) {
+			sx = (rotated ? t->matrix22 : t->matrix11)/65536.0;
+			sy = (rotated ? t->matrix11 : t->matrix22)/65536.0;
+		}
+		print_crtc_transform(out, sx, sy, mode_w, mode_h, mmw, mmh);
+	}
+
+	if (!panning || !panning->width || !panning->height)
+		return NULL;
+	print_crtc_panning(out, panning->left, panning->top, panning->width, panning->height);
+	return panning;
+}
+
+/* Only run for whole reports: queries with selectors only run the Xlib
+ * pass, which fetches the CRTC of the selected outputs alone (see main)
+ */
+static void do_xcb_dpi(FILE *out, xcb_connection_t *conn)
 {
 	xcb_screen_iterator_t iter = xcb_setup_roots_iterator(xcb_get_setup(conn));
 	xcb_generic_error_t *err = NULL;
@@ -526,6 +1121,10 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 		calloc(iter.rem, sizeof(*rr_output)) : NULL;
 	xcb_randr_get_crtc_info_reply_t ***rr_crtc_info = randr_active ?
 		calloc(iter.rem, sizeof(*rr_crtc_info)) : NULL;
+	xcb_randr_get_crtc_transform_reply_t ***rr_transform = randr_active ?
+		calloc(iter.rem, sizeof(*rr_transform)) : NULL;
+	xcb_randr_get_panning_reply_t ***rr_panning = randr_active ?
+		calloc(iter.rem, sizeof(*rr_panning)) : NULL;
 	xcb_randr_get_output_info_reply_t ***rr_out = randr_active ?
 		calloc(iter.rem, sizeof(*rr_out)) : NULL;
 
@@ -549,13 +1148,14 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 	xcb_randr_get_monitors_cookie_t *rr_mon_cookie = has_randr_monitors ?
 		malloc(iter.rem*sizeof(*rr_cookie)) : NULL;
 	xcb_randr_get_monitors_reply_t **rr_mon = has_randr_monitors ?
-		malloc(iter.rem*sizeof(*rr_mon)) : NULL;
+		calloc(iter.rem, sizeof(*rr_mon)) : NULL;
 
 	if (!screen_data) {
 		fputs("could not allocate memory for screen data\n", stderr);
 		goto cleanup;
 	}
-	if (randr_active && !(rr_cookie && rr_res && rr_crtc && rr_crtc_info && rr_out)) {
+	if (randr_active && !(rr_cookie && rr_res && rr_crtc && rr_crtc_info &&
+			rr_transform && rr_panning && rr_out)) {
 		fputs("could not allocate memory for RANDR data\n", stderr);
 		goto cleanup;
 	}
@@ -609,6 +1209,8 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 		int num_outputs = 0;
 
 		xcb_randr_get_crtc_info_cookie_t *crtc_cookie = NULL;
+		xcb_randr_get_crtc_transform_cookie_t *transform_cookie = NULL;
+		xcb_randr_get_panning_cookie_t *panning_cookie = NULL;
 		xcb_randr_get_output_info_cookie_t *output_cookie = NULL;
 
 		rr_res[i] = xcb_randr_get_screen_resources_reply(conn,
@@ -664,6 +1266,19 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 			for (j = 0; j < num_crtcs; ++j)
 				crtc_cookie[j] = xcb_randr_get_crtc_info(conn, rr_crtc[i][j],  0);
 
+			/* The CRTC transforms and panning (RANDR 1.3, like the primary
+			 * output) go in the same batch, so they cost no extra round trip */
+			if (has_randr_primary) {
+				transform_cookie = calloc(num_crtcs, sizeof(*transform_cookie));
+				panning_cookie = calloc(num_crtcs, sizeof(*panning_cookie));
+				if (!transform_cookie || !panning_cookie)
+					error("could not allocate memory for RANDR request cookies");
+				for (j = 0; j < num_crtcs; ++j) {
+					transform_cookie[j] = xcb_randr_get_crtc_transform(conn, rr_crtc[i][j]);
+					panning_cookie[j] = xcb_randr_get_panning(conn, rr_crtc[i][j]);
+				}
+			}
+
 			/* Output requests */
 			for (j = 0; j < num_outputs; ++j)
 				output_cookie[j] = xcb_randr_get_output_info(conn, rr_output[i][j],  0);
@@ -685,6 +1300,20 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 				}
 			}
 
+			/* These are only informative, so failures are ignored */
+			if (has_randr_primary) {
+				rr_transform[i] = calloc(num_crtcs, sizeof(**rr_transform));
+				rr_panning[i] = calloc(num_crtcs, sizeof(**rr_panning));
+				if (!rr_transform[i] || !rr_panning[i])
+					error("could not allocate memory for RANDR data");
+				for (j = 0; j < num_crtcs; ++j) {
+					rr_transform[i][j] = xcb_randr_get_crtc_transform_reply(conn,
+						transform_cookie[j], NULL);
+					rr_panning[i][j] = xcb_randr_get_panning_reply(conn,
+						panning_cookie[j], NULL);
+				}
+			}
+
 			for (j = 0; j < num_outputs; ++j) {
 				rr_out[i][j] = xcb_randr_get_output_info_reply(conn, output_cookie[j], &err);
 				if (err) {
@@ -705,6 +1334,8 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 		} while (0);
 
 		free(output_cookie);
+		free(panning_cookie);
+		free(transform_cookie);
 		free(crtc_cookie);
 		if (err) {
 			free(err);
@@ -728,30 +1359,35 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 	/* Show it */
 	for (i = 0; i < count; ++i) {
 		xcb_randr_output_t primary = -1;
-		if (has_randr_primary)
+		if (has_randr_primary && rr_primary_reply[i])
 			primary = rr_primary_reply[i]->output;
+		struct output_rotations rotations = { .rotated = NULL };
 
 		const xcb_screen_t *screen = screen_data + i;
 		/* Standard X11 information */
-		{
-			print_dpi_screen(i,
-				screen->width_in_pixels, screen->height_in_pixels,
-				screen->width_in_millimeters, screen->height_in_millimeters);
-		}
+		print_dpi_screen(out, i,
+			screen->width_in_pixels, screen->height_in_pixels,
+			screen->width_in_millimeters, screen->height_in_millimeters);
 		/* XRANDR information */
+		if (randr_active)
+			report(out, "\tXRandR (%d.%d):\n", rr_major, rr_minor);
 		if (randr_active && rr_res[i]) {
-			printf("\tXRandR (%d.%d):\n", rr_major, rr_minor);
 			const xcb_randr_get_screen_resources_reply_t *rr = rr_res[i];
+			const xcb_randr_mode_info_t *modes = xcb_randr_get_screen_resources_modes(rr);
+			struct xid_index crtc_index, mode_index;
+			xid_index_init(&crtc_index, rr->num_crtcs);
+			xid_index_init(&mode_index, rr->num_modes);
+			for (int c = 0; c < rr->num_crtcs; ++c)
+				xid_index_add(&crtc_index, rr_crtc[i][c], c);
+			for (int m = 0; m < rr->num_modes; ++m)
+				xid_index_add(&mode_index, modes[m].id, m);
+			output_rotations_init(&rotations, rr->num_outputs);
+
 			for (int o = 0; o < rr->num_outputs; ++o) {
 				const xcb_randr_get_output_info_reply_t *rro = rr_out[i][o];
-				if (rro->crtc) {
-					int c = 0;
-					while (c < rr->num_crtcs) {
-						if (rr_crtc[i][c] == rro->crtc)
-							break;
-						++c;
-					}
-					if (c < rr->num_crtcs) {
+				if (rro && rro->crtc) {
+					const int c = xid_index_find(&crtc_index, rro->crtc);
+					if (c >= 0 && rr_crtc_info[i][c]) {
 						const xcb_randr_get_crtc_info_reply_t *rrc = rr_crtc_info[i][c];
 						uint16_t w = rrc->width;
 						uint16_t h = rrc->height;
@@ -761,51 +1397,74 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 
 						uint32_t mmw = rotated ? rro->mm_height : rro->mm_width;
 						uint32_t mmh = rotated ? rro->mm_width : rro->mm_height;
+						output_rotations_set(&rotations, rr_output[i][o], o, rotated);
 
 						/* NOTE: rr_name is NOT for us to free. It's also not guaranteed to be
 						 * NULL-terminated, so we copy it to our own string */
 						const uint8_t *rr_name = xcb_randr_get_output_info_name(rro);
 						char *name = calloc(rro->name_len + 1, sizeof(char));
 						if (name) memcpy(name, rr_name, rro->name_len);
-						print_dpi_randr(name, mmw, mmh, w, h,
+						const int m = xid_index_find(&mode_index, rrc->mode);
+						print_dpi_randr(out, name, mmw, mmh, w, h,
 							rotated,
 							primary == rr_output[i][o],
 							rro->connection);
+						xcb_print_crtc_extras(out, rrc,
+							rr_transform[i] ? rr_transform[i][c] : NULL,
+							rr_panning[i] ? rr_panning[i][c] : NULL,
+							m >= 0 ? modes + m : NULL,
+							rotated, mmw, mmh);
 						free(name);
 					}
 				}
 			}
+			xid_index_free(&crtc_index);
+			xid_index_free(&mode_index);
+		}
 
-			if (has_randr_monitors) {
-				puts("\tMonitors:");
-				xcb_randr_monitor_info_iterator_t rr_mon_iter =
-					xcb_randr_get_monitors_monitors_iterator(rr_mon[i]);
-				while (rr_mon_iter.rem) {
-					const xcb_randr_monitor_info_t *mon = rr_mon_iter.data;
-					/* TODO get atom names all at once? */
-					const xcb_get_atom_name_cookie_t name_cookie = xcb_get_atom_name(conn, mon->name);
-					xcb_get_atom_name_reply_t *name_rep = xcb_get_atom_name_reply(conn, name_cookie, &err);
-					char *name = NULL;
-					if (err) {
-						fprintf(stderr, "error getting atom name -- %d \n",
-							err->error_code);
-						free(err);
-						err = NULL;
-					} else {
-						size_t name_l = xcb_get_atom_name_name_length(name_rep);
-						name = calloc(name_l+1, sizeof(char));
-						if (name) memcpy(name, xcb_get_atom_name_name(name_rep), name_l);
-					}
-					print_dpi_monitor(name,
-						mon->width, mon->height,
-						mon->width_in_millimeters, mon->height_in_millimeters,
-						mon->primary, mon->automatic);
-					free(name);
-					free(name_rep);
-					xcb_randr_monitor_info_next(&rr_mon_iter);
+		if (randr_active && has_randr_monitors && rr_mon[i]) {
+			report(out, "\tMonitors:\n");
+			/* Request all the monitor names before waiting for any,
+			 * so that they only cost one round trip */
+			const int n = xcb_randr_get_monitors_monitors_length(rr_mon[i]);
+			xcb_get_atom_name_cookie_t *name_cookie = calloc(n + 1, sizeof(*name_cookie));
+			if (!name_cookie)
+				error("could not allocate memory for monitor names");
+			xcb_randr_monitor_info_iterator_t it =
+				xcb_randr_get_monitors_monitors_iterator(rr_mon[i]);
+			for (int m = 0; it.rem; ++m, xcb_randr_monitor_info_next(&it))
+				name_cookie[m] = xcb_get_atom_name(conn, it.data->name);
+
+			xcb_randr_monitor_info_iterator_t rr_mon_iter =
+				xcb_randr_get_monitors_monitors_iterator(rr_mon[i]);
+			for (int m = 0; rr_mon_iter.rem; ++m, xcb_randr_monitor_info_next(&rr_mon_iter)) {
+				const xcb_randr_monitor_info_t *mon = rr_mon_iter.data;
+				const xcb_randr_output_t *mon_outputs = xcb_randr_monitor_info_outputs(mon);
+				int rotated = -1;
+				for (int k = 0; k < xcb_randr_monitor_info_outputs_length(mon); ++k)
+					rotated = fold_rotation(rotated, &rotations, mon_outputs[k]);
+				xcb_get_atom_name_reply_t *name_rep = xcb_get_atom_name_reply(conn, name_cookie[m], &err);
+				char *name = NULL;
+				if (err) {
+					fprintf(stderr, "error getting atom name -- %d \n",
+						err->error_code);
+					free(err);
+					err = NULL;
+				} else {
+					size_t name_l = xcb_get_atom_name_name_length(name_rep);
+					name = calloc(name_l+1, sizeof(char));
+					if (name) memcpy(name, xcb_get_atom_name_name(name_rep), name_l);
 				}
+				print_dpi_monitor(out, name,
+					mon->width, mon->height,
+					mon->width_in_millimeters, mon->height_in_millimeters,
+					rotated, mon->primary, mon->automatic);
+				free(name);
+				free(name_rep);
 			}
+			free(name_cookie);
 		}
+		output_rotations_free(&rotations);
 	}
 
 	if (xine_active) {
@@ -813,10 +1472,10 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 		xcb_xinerama_screen_info_iterator_t iter = xcb_xinerama_query_screens_screen_info_iterator(xine_reply);
 		int num_xines = iter.rem;
 		if (num_xines > 0)
-			puts("Xinerama screens:");
+			report(out, "Xinerama screens:\n");
 		for (int i = 0; i < num_xines; ++i, xcb_xinerama_screen_info_next(&iter)) {
 			const xcb_xinerama_screen_info_t *xi = iter.data;
-			printf("\t%u: %ux%u pixels, no dpi information\n",
+			report(out, "\t%u: %ux%u pixels, no dpi information\n",
 				i,
 				xi->width,
 				xi->height);
@@ -829,8 +1488,8 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 		char *dpi = NULL;
 		xcb_xrm_resource_get_string(xrmdb, "Xft.dpi", NULL, &dpi);
 		if (dpi) {
-			puts("X resources:");
-			printf("\tXft.dpi: %s\n", dpi);
+			report(out, "X resources:\n");
+			report(out, "\tXft.dpi: %s\n", dpi);
 		}
 		free(dpi);
 		xcb_xrm_database_free(xrmdb);
@@ -839,18 +1498,28 @@ static void do_xcb_dpi(xcb_connection_t *conn)
 cleanup:
 	free(screen_data);
 	free(rr_cookie);
-	if (randr_active) for (i = 0; i < count; ++i) {
+	/* RANDR may have been disabled by an error after the allocations */
+	if (rr_res) for (i = 0; i < count; ++i) {
 		const xcb_randr_get_screen_resources_reply_t *rr = rr_res[i];
-		for (int o = 0; o < rr->num_outputs; ++o)
+		/* Screens past a RANDR error have no data */
+		if (rr && rr_out[i]) for (int o = 0; o < rr->num_outputs; ++o)
 			free(rr_out[i][o]);
-		for (int c = 0; c < rr->num_crtcs; ++c)
+		if (rr && rr_crtc_info[i]) for (int c = 0; c < rr->num_crtcs; ++c)
 			free(rr_crtc_info[i][c]);
+		if (rr && rr_transform[i]) for (int c = 0; c < rr->num_crtcs; ++c)
+			free(rr_transform[i][c]);
+		if (rr && rr_panning[i]) for (int c = 0; c < rr->num_crtcs; ++c)
+			free(rr_panning[i][c]);
 		free(rr_out[i]);
 		free(rr_crtc_info[i]);
+		free(rr_transform[i]);
+		free(rr_panning[i]);
 		free(rr_res[i]);
 	}
 	free(rr_out);
 	free(rr_crtc_info);
+	free(rr_transform);
+	free(rr_panning);
 	free(rr_output);
 	free(rr_crtc);
 	free(rr_res);
@@ -871,105 +1540,3352 @@ cleanup:
 /* TODO FIXME this returns an error value, while xlib_dpi returns the number of screens
  * (for use by print_scaling_factors)
  */
-static int xcb_dpi(void)
+static int xcb_dpi(FILE *out)
 {
-	puts("** xcb interfaces");
+	report(out, "** xcb interfaces\n");
 	int ret = 0;
 	xcb_connection_t *conn = xcb_connect(NULL, NULL);
 	if ((ret = xcb_connection_has_error(conn))) {
 		fputs("XCB connection error\n", stderr);
 	} else {
-		do_xcb_dpi(conn);
+		do_xcb_dpi(out, conn);
 
 		xcb_disconnect(conn);
 	}
 	return ret;
 }
-#endif
 
-struct scaling_factor
+/* The xcb pass runs on its own thread, with its own connection, concurrently
+ * with the Xlib pass, collecting its report in a separate buffer that is
+ * shown after the Xlib one. Since Xlib is only used by the main thread,
+ * and xcb is thread-safe, there is no need for XInitThreads.
+ */
+struct xcb_pass
 {
-	int min;
-	float actual;
-	int round;
-	int max;
+	pthread_t thread;
+	FILE *out;
+	char *report;
+	size_t report_len;
+	int ret;
 };
 
-static inline
-struct scaling_factor calc_scaling(float actual)
+static void *xcb_dpi_thread(void *arg)
 {
-	struct scaling_factor ret = {
-		.min = (int)floor(actual),
-		.actual = actual,
-		.round = (int)round(actual),
-		.max = (int)ceil(actual)
-	};
+	struct xcb_pass *pass = arg;
+	pass->ret = xcb_dpi(pass->out);
+	return NULL;
+}
 
-	if (ret.min < 1) ret.min = 1;
-	if (ret.round < 1) ret.round = 1;
-	if (ret.max < 1) ret.max = 1;
+/* Start the xcb pass. Returns False (and runs nothing) if the report buffer
+ * or the thread could not be created, so that the caller can fall back
+ * to running the pass synchronously
+ */
+static Bool xcb_dpi_start(struct xcb_pass *pass)
+{
+	pass->out = open_memstream(&pass->report, &pass->report_len);
+	if (!pass->out)
+		return False;
+	if (pthread_create(&pass->thread, NULL, xcb_dpi_thread, pass)) {
+		fclose(pass->out);
+		free(pass->report);
+		pass->report = NULL;
+		return False;
+	}
+	return True;
+}
 
-	return ret;
+/* Wait for the xcb pass to finish, and show its report */
+static int xcb_dpi_finish(struct xcb_pass *pass, FILE *out)
+{
+	pthread_join(pass->thread, NULL);
+	fclose(pass->out);
+	fwrite(pass->report, 1, pass->report_len, out);
+	free(pass->report);
+	return pass->ret;
 }
 
-static inline
-void print_scaling_factor(struct scaling_factor scaling)
+/*
+ * Minimal round-trip mode
+ */
+
+/* Over high-latency links (e.g. SSH-forwarded or tunnelled X), each reply
+ * we wait for costs a full round trip. In fast mode, the requests are
+ * batched so that we only wait for:
+ * 1. the RANDR version and monitors of every root, together with anything
+ *    else that does not depend on other replies (primary output, screen
+ *    resources, Xinerama screens);
+ * 2. if needed, the monitor names and the output and CRTC information.
+ * Like the connection setup, the RANDR (and Xinerama, if asked) extension
+ * data costs one more round trip per connection, since xcb needs its major
+ * opcode to encode any request of the extension; the core requests
+ * (RESOURCE_MANAGER, and the name of the selected monitor) go with it.
+ * Output enumeration only happens if a specific output was selected
+ * (or for the journal), and Xinerama is only queried if asked for.
+ */
+Bool fast_mode = False;
+Bool fast_xinerama = False;
+/* Enumerate the outputs even without --output, for the journal records */
+Bool fast_all_outputs = False;
+
+/* Round trips done by the fast pass */
+int fast_round_trips = 0;
+
+/* The name in an atom name reply, if any; the reply is not freed */
+static char *fast_atom_name(const xcb_get_atom_name_reply_t *rep)
 {
-	printf("%d %.2g %d %d",
-		scaling.min, scaling.actual, scaling.round, scaling.max);
+	if (!rep)
+		return NULL;
+	size_t len = xcb_get_atom_name_name_length(rep);
+	char *name = calloc(len + 1, sizeof(char));
+	if (name) memcpy(name, xcb_get_atom_name_name(rep), len);
+	return name;
 }
 
-void print_scaling_factors(int num_screens)
+/* The Xft.dpi value in a RESOURCE_MANAGER property reply, if any.
+ * The returned string must be freed
+ */
+static char *xcb_xft_dpi(const xcb_get_property_reply_t *xrm)
 {
-	for (int i = 0; i < num_screens; ++i) {
-		printf("Screen %d:\n", i);
-		float reference = reference_dpi[i]/96.0f;
-		printf("\treference scaling: ");
-		print_scaling_factor(calc_scaling(reference));
-		puts("");
-
-		if (nmon[i]) {
-			/* TODO FIXME we assume that the first enumerated monitor is the primary one,
-			 * we should keep its index around */
-			int primary_dpi = monitor_dpi[i][0].dpi;
-			printf("\tmonitors:\n");
-			for (int m = 0; m < nmon[i]; ++m) {
-				printf("\t\t%s:\n", monitor_dpi[i][m].name);
-				int dpi = monitor_dpi[i][m].dpi;
-				float native = dpi/96.0f;
-				float rated = (reference*dpi)/primary_dpi;
-				printf("\t\t\tnative: ");
-				print_scaling_factor(calc_scaling(native));
-				printf("\n\t\t\tprorated: ");
-				print_scaling_factor(calc_scaling(rated));
-				puts("");
-			}
-		}
-		free(monitor_dpi[i]);
+	if (!xrm || xrm->format != 8 || xcb_get_property_value_length(xrm) <= 0)
+		return NULL;
+
+	const int len = xcb_get_property_value_length(xrm);
+	char *resources = calloc(len + 1, sizeof(char));
+	if (!resources) error("out of memory for X resources");
+	memcpy(resources, xcb_get_property_value(xrm), len);
+	xcb_xrm_database_t *xrmdb = xcb_xrm_database_from_string(resources);
+	char *dpi = NULL;
+	if (xrmdb) {
+		xcb_xrm_resource_get_string(xrmdb, "Xft.dpi", NULL, &dpi);
+		xcb_xrm_database_free(xrmdb);
+	}
+	free(resources);
+	return dpi;
+}
 
-		if (noutput[i]) {
-			/* TODO FIXME we assume that the first enumerated output is the primary one,
-			 * we should keep its index around */
-			int primary_dpi = output_dpi[i][0].dpi;
-			printf("\toutputs:\n");
-			for (int o = 0; o < noutput[i]; ++o) {
-				int dpi = output_dpi[i][o].dpi;
-				if (dpi < 0) continue; /* output is not connected */
-				printf("\t\t%s:\n", output_dpi[i][o].name);
-				float native = dpi/96.0f;
-				float rated = (reference*dpi)/primary_dpi;
-				printf("\t\t\tnative: ");
-				print_scaling_factor(calc_scaling(native));
-				printf("\n\t\t\tprorated: ");
-				print_scaling_factor(calc_scaling(rated));
-				puts("");
+static int do_fast_xcb_dpi(FILE *out, xcb_connection_t *conn)
+{
+	const xcb_setup_t *setup = xcb_get_setup(conn);
+	const int num_screens = xcb_setup_roots_length(setup);
+	const Bool fast_outputs = sel.output != NULL || fast_all_outputs;
+	xcb_generic_error_t *err = NULL;
+
+	reference_dpi = calloc(num_screens, sizeof(*reference_dpi));
+	noutput = calloc(num_screens, sizeof(*noutput));
+	nmon = calloc(num_screens, sizeof(*nmon));
+	output_dpi = calloc(num_screens, sizeof(*output_dpi));
+	monitor_dpi = calloc(num_screens, sizeof(*monitor_dpi));
+	config_time = calloc(num_screens, sizeof(*config_time));
+
+	xcb_screen_t *screens = calloc(num_screens, sizeof(*screens));
+	xcb_randr_get_monitors_cookie_t *mon_cookie = calloc(num_screens, sizeof(*mon_cookie));
+	xcb_randr_get_monitors_reply_t **mon = calloc(num_screens, sizeof(*mon));
+	xcb_randr_get_output_primary_cookie_t *prim_cookie = calloc(num_screens, sizeof(*prim_cookie));
+	xcb_randr_get_screen_resources_current_cookie_t *res_cookie = calloc(num_screens, sizeof(*res_cookie));
+	xcb_randr_get_screen_resources_current_reply_t **res = calloc(num_screens, sizeof(*res));
+	xcb_randr_output_t *primary = calloc(num_screens, sizeof(*primary));
+
+	if (!reference_dpi || !noutput || !nmon || !output_dpi || !monitor_dpi || !config_time ||
+		!screens || !mon_cookie || !mon || !prim_cookie || !res_cookie || !res || !primary)
+		error("out of memory during fast DPI information retrieval");
+
+	xcb_screen_iterator_t iter = xcb_setup_roots_iterator(setup);
+	for (int i = 0; iter.rem; ++i, xcb_screen_next(&iter))
+		screens[i] = *iter.data;
+
+	/* Extension data, together with the core requests */
+	xcb_prefetch_extension_data(conn, &xcb_randr_id);
+	if (fast_xinerama)
+		xcb_prefetch_extension_data(conn, &xcb_xinerama_id);
+	xcb_get_property_cookie_t xrm_cookie = xcb_get_property(conn, 0, screens[0].root,
+		XCB_ATOM_RESOURCE_MANAGER, XCB_ATOM_STRING, 0, 0x1000000);
+	xcb_intern_atom_cookie_t sel_monitor_cookie;
+	if (sel.monitor)
+		sel_monitor_cookie = xcb_intern_atom(conn, 1, strlen(sel.monitor), sel.monitor);
+	const int randr_active = xcb_get_extension_data(conn, &xcb_randr_id)->present;
+	const int xine_active = fast_xinerama &&
+		xcb_get_extension_data(conn, &xcb_xinerama_id)->present;
+
+	/* Round trip 1: everything that does not depend on other replies */
+	xcb_randr_query_version_cookie_t ver_cookie;
+	xcb_xinerama_query_screens_cookie_t xine_cookie;
+
+	if (randr_active) {
+		ver_cookie = xcb_randr_query_version(conn, 1, 5);
+		for (int i = 0; i < num_screens; ++i) {
+			if (!screen_selected(i))
+				continue;
+			if (want_monitors())
+				mon_cookie[i] = xcb_randr_get_monitors(conn, screens[i].root, 1);
+			prim_cookie[i] = xcb_randr_get_output_primary(conn, screens[i].root);
+			if (fast_outputs)
+				res_cookie[i] = xcb_randr_get_screen_resources_current(conn, screens[i].root);
+		}
+	}
+	if (xine_active)
+		xine_cookie = xcb_xinerama_query_screens(conn);
+
+	uint32_t rr_major = 0, rr_minor = 0;
+	xcb_atom_t sel_monitor_atom = XCB_ATOM_NONE;
+	if (randr_active) {
+		xcb_randr_query_version_reply_t *ver = xcb_randr_query_version_reply(conn, ver_cookie, &err);
+		if (ver) {
+			rr_major = ver->major_version;
+			rr_minor = ver->minor_version;
+		}
+		free(ver);
+		free(err);
+		err = NULL;
+
+		/* Requests unsupported by older servers just fail */
+		for (int i = 0; i < num_screens; ++i) {
+			if (!screen_selected(i))
+				continue;
+			if (want_monitors())
+				mon[i] = xcb_randr_get_monitors_reply(conn, mon_cookie[i], NULL);
+			xcb_randr_get_output_primary_reply_t *prim =
+				xcb_randr_get_output_primary_reply(conn, prim_cookie[i], NULL);
+			if (prim)
+				primary[i] = prim->output;
+			free(prim);
+			if (fast_outputs)
+				res[i] = xcb_randr_get_screen_resources_current_reply(conn, res_cookie[i], NULL);
+		}
+	}
+
+	xcb_get_property_reply_t *xrm = xcb_get_property_reply(conn, xrm_cookie, NULL);
+	if (sel.monitor) {
+		xcb_intern_atom_reply_t *atom = xcb_intern_atom_reply(conn, sel_monitor_cookie, NULL);
+		if (atom)
+			sel_monitor_atom = atom->atom;
+		free(atom);
+	}
+	xcb_xinerama_query_screens_reply_t *xine_reply = xine_active ?
+		xcb_xinerama_query_screens_reply(conn, xine_cookie, NULL) : NULL;
+	++fast_round_trips;
+
+	/* Round trip 2, if needed: monitor names, output and CRTC information,
+	 * including the CRTC transforms and panning */
+	Bool second_round_trip = False;
+
+	xcb_get_atom_name_cookie_t **name_cookie = calloc(num_screens, sizeof(*name_cookie));
+	xcb_randr_get_output_info_cookie_t **out_cookie = calloc(num_screens, sizeof(*out_cookie));
+	xcb_randr_get_crtc_info_cookie_t **crtc_cookie = calloc(num_screens, sizeof(*crtc_cookie));
+	xcb_randr_get_crtc_transform_cookie_t **transform_cookie = calloc(num_screens, sizeof(*transform_cookie));
+	xcb_randr_get_panning_cookie_t **panning_cookie = calloc(num_screens, sizeof(*panning_cookie));
+	if (!name_cookie || !out_cookie || !crtc_cookie || !transform_cookie || !panning_cookie)
+		error("out of memory during fast DPI information retrieval");
+
+	for (int i = 0; i < num_screens; ++i) {
+		if (mon[i] && !sel.monitor) {
+			const int n = xcb_randr_get_monitors_monitors_length(mon[i]);
+			name_cookie[i] = calloc(n + 1, sizeof(**name_cookie));
+			if (!name_cookie[i]) error("out of memory for monitor names");
+			xcb_randr_monitor_info_iterator_t it = xcb_randr_get_monitors_monitors_iterator(mon[i]);
+			for (int m = 0; it.rem; ++m, xcb_randr_monitor_info_next(&it))
+				name_cookie[i][m] = xcb_get_atom_name(conn, it.data->name);
+			second_round_trip = second_round_trip || n > 0;
+		}
+		if (res[i]) {
+			config_time[i] = res[i]->config_timestamp;
+			const int no = xcb_randr_get_screen_resources_current_outputs_length(res[i]);
+			const int nc = xcb_randr_get_screen_resources_current_crtcs_length(res[i]);
+			const xcb_randr_output_t *outputs = xcb_randr_get_screen_resources_current_outputs(res[i]);
+			const xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_current_crtcs(res[i]);
+			out_cookie[i] = calloc(no + 1, sizeof(**out_cookie));
+			crtc_cookie[i] = calloc(nc + 1, sizeof(**crtc_cookie));
+			transform_cookie[i] = calloc(nc + 1, sizeof(**transform_cookie));
+			panning_cookie[i] = calloc(nc + 1, sizeof(**panning_cookie));
+			if (!out_cookie[i] || !crtc_cookie[i] || !transform_cookie[i] || !panning_cookie[i])
+				error("out of memory for RANDR cookies");
+			for (int o = 0; o < no; ++o)
+				out_cookie[i][o] = xcb_randr_get_output_info(conn, outputs[o], res[i]->config_timestamp);
+			for (int c = 0; c < nc; ++c) {
+				crtc_cookie[i][c] = xcb_randr_get_crtc_info(conn, crtcs[c], res[i]->config_timestamp);
+				transform_cookie[i][c] = xcb_randr_get_crtc_transform(conn, crtcs[c]);
+				panning_cookie[i][c] = xcb_randr_get_panning(conn, crtcs[c]);
+			}
+			second_round_trip = second_round_trip || no > 0;
+		}
+	}
+	if (second_round_trip)
+		++fast_round_trips;
+
+	/* Show it */
+	for (int i = 0; i < num_screens; ++i) {
+		if (!screen_selected(i))
+			continue;
+
+		const xcb_screen_t *screen = screens + i;
+		struct output_rotations rotations = { .rotated = NULL };
+		reference_dpi[i] = print_dpi_screen(targeted_query() ? NULL : out, i,
+			screen->width_in_pixels, screen->height_in_pixels,
+			screen->width_in_millimeters, screen->height_in_millimeters);
+
+		if (randr_active && !targeted_query())
+			report(out, "\tXRandR (%d.%d):\n", rr_major, rr_minor);
+
+		if (res[i]) {
+			const int no = xcb_randr_get_screen_resources_current_outputs_length(res[i]);
+			const int nc = xcb_randr_get_screen_resources_current_crtcs_length(res[i]);
+			const xcb_randr_output_t *outputs = xcb_randr_get_screen_resources_current_outputs(res[i]);
+			const xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_current_crtcs(res[i]);
+			const xcb_randr_mode_info_t *modes = xcb_randr_get_screen_resources_current_modes(res[i]);
+			const int nmodes = xcb_randr_get_screen_resources_current_modes_length(res[i]);
+			xcb_randr_get_crtc_info_reply_t **crtc_info = calloc(nc + 1, sizeof(*crtc_info));
+			xcb_randr_get_crtc_transform_reply_t **transform = calloc(nc + 1, sizeof(*transform));
+			xcb_randr_get_panning_reply_t **panning = calloc(nc + 1, sizeof(*panning));
+			output_dpi[i] = calloc(no + 1, sizeof(**output_dpi));
+			if (!crtc_info || !transform || !panning || !output_dpi[i])
+				error("out of memory for output DPI");
+			noutput[i] = no;
+
+			for (int c = 0; c < nc; ++c) {
+				crtc_info[c] = xcb_randr_get_crtc_info_reply(conn, crtc_cookie[i][c], NULL);
+				transform[c] = xcb_randr_get_crtc_transform_reply(conn, transform_cookie[i][c], NULL);
+				panning[c] = xcb_randr_get_panning_reply(conn, panning_cookie[i][c], NULL);
+			}
+
+			struct xid_index crtc_index, mode_index;
+			xid_index_init(&crtc_index, nc);
+			xid_index_init(&mode_index, nmodes);
+			for (int c = 0; c < nc; ++c)
+				xid_index_add(&crtc_index, crtcs[c], c);
+			for (int m = 0; m < nmodes; ++m)
+				xid_index_add(&mode_index, modes[m].id, m);
+			output_rotations_init(&rotations, no);
+
+			for (int o = 0; o < no; ++o) {
+				struct named_dpi *rec = output_dpi[i] + o;
+				xcb_randr_get_output_info_reply_t *rro =
+					xcb_randr_get_output_info_reply(conn, out_cookie[i][o], NULL);
+				rec->dpi = -1;
+				if (!rro)
+					continue;
+				rec->connection = rro->connection;
+				const int name_len = rro->name_len < STRMAX ? rro->name_len : STRMAX;
+				memcpy(rec->name, xcb_randr_get_output_info_name(rro), name_len);
+				rec->name[name_len] = '\0';
+				const int c = xid_index_find(&crtc_index, rro->crtc);
+				const xcb_randr_get_crtc_info_reply_t *rrc = c >= 0 ? crtc_info[c] : NULL;
+				if (rrc) {
+					const uint16_t rot = (rrc->rotation & 0x0f);
+					const int rotated = ((rot == XCB_RANDR_ROTATION_ROTATE_90) || (rot == XCB_RANDR_ROTATION_ROTATE_270));
+					const uint32_t mmw = rotated ? rro->mm_height : rro->mm_width;
+					const uint32_t mmh = rotated ? rro->mm_width : rro->mm_height;
+					output_rotations_set(&rotations, outputs[o], o, rotated);
+					rec->primary = primary[i] == outputs[o];
+					rec->x = rrc->x;
+					rec->y = rrc->y;
+					rec->width = rrc->width;
+					rec->height = rrc->height;
+					rec->mmw = mmw;
+					rec->mmh = mmh;
+					const Bool selected = output_selected(rec->name);
+					rec->dpi = print_dpi_randr(selected ? out : NULL, rec->name,
+						mmw, mmh, rrc->width, rrc->height,
+						rotated, rec->primary, rro->connection);
+					const int m = xid_index_find(&mode_index, rrc->mode);
+					const xcb_randr_get_panning_reply_t *pan = xcb_print_crtc_extras(
+						selected ? out : NULL, rrc, transform[c], panning[c],
+						m >= 0 ? modes + m : NULL, rotated, mmw, mmh);
+					/* The output covers the whole panning area */
+					if (pan) {
+						rec->x = pan->left;
+						rec->y = pan->top;
+						rec->width = pan->width;
+						rec->height = pan->height;
+					}
+					if (selected)
+						++sel.found;
+				} else if (sel.output && output_selected(rec->name)) {
+					print_inactive_output(out, rec->name, rro->connection);
+					++sel.found;
+				}
+				free(rro);
+			}
+
+			xid_index_free(&crtc_index);
+			xid_index_free(&mode_index);
+			for (int c = 0; c < nc; ++c) {
+				free(crtc_info[c]);
+				free(transform[c]);
+				free(panning[c]);
+			}
+			free(crtc_info);
+			free(transform);
+			free(panning);
+		}
+
+		if (mon[i]) {
+			const int n = xcb_randr_get_monitors_monitors_length(mon[i]);
+			monitor_dpi[i] = calloc(n + 1, sizeof(**monitor_dpi));
+			if (!monitor_dpi[i]) error("out of memory for monitor DPI");
+			nmon[i] = n;
+
+			if (n > 0 && !targeted_query())
+				report(out, "\tMonitors:\n");
+
+			xcb_randr_monitor_info_iterator_t it = xcb_randr_get_monitors_monitors_iterator(mon[i]);
+			for (int m = 0; it.rem; ++m, xcb_randr_monitor_info_next(&it)) {
+				const xcb_randr_monitor_info_t *mi = it.data;
+				struct named_dpi *rec = monitor_dpi[i] + m;
+				Bool selected = True;
+				if (sel.monitor) {
+					selected = mi->name == sel_monitor_atom;
+					if (selected)
+						strncpy(rec->name, sel.monitor, STRMAX);
+				} else {
+					xcb_get_atom_name_reply_t *rep =
+						xcb_get_atom_name_reply(conn, name_cookie[i][m], NULL);
+					char *name = fast_atom_name(rep);
+					strncpy(rec->name, name ? name : "<error>", STRMAX);
+					free(name);
+					free(rep);
+				}
+				rec->primary = mi->primary;
+				rec->x = mi->x;
+				rec->y = mi->y;
+				rec->width = mi->width;
+				rec->height = mi->height;
+				const xcb_randr_output_t *mon_outputs = xcb_randr_monitor_info_outputs(mi);
+				int rotated = -1;
+				for (int k = 0; k < xcb_randr_monitor_info_outputs_length(mi); ++k)
+					rotated = fold_rotation(rotated, &rotations, mon_outputs[k]);
+				rec->dpi = print_dpi_monitor(selected ? out : NULL, rec->name,
+					mi->width, mi->height,
+					mi->width_in_millimeters, mi->height_in_millimeters,
+					rotated, mi->primary, mi->automatic);
+				if (selected && sel.monitor)
+					++sel.found;
+			}
+		}
+		output_rotations_free(&rotations);
+	}
+
+	if (xine_reply) {
+		xcb_xinerama_screen_info_iterator_t it = xcb_xinerama_query_screens_screen_info_iterator(xine_reply);
+		if (it.rem > 0)
+			report(out, "Xinerama screens:\n");
+		for (int x = 0; it.rem; ++x, xcb_xinerama_screen_info_next(&it))
+			report(out, "\t%u: %ux%u pixels, no dpi information\n",
+				x, it.data->width, it.data->height);
+	}
+
+	/* Xft.dpi, from the RESOURCE_MANAGER we already fetched */
+	char *dpi = xcb_xft_dpi(xrm);
+	if (dpi) {
+		if (!targeted_query()) {
+			report(out, "X resources:\n");
+			report(out, "\tXft.dpi: %s\n", dpi);
+		}
+		float xft_dpi = strtof(dpi, NULL);
+		/* Override core DPI only if valid */
+		if (xft_dpi > 0) for (int i = 0; i < num_screens; ++i)
+			if (screen_selected(i))
+				reference_dpi[i] = xft_dpi;
+	}
+	free(dpi);
+
+	for (int i = 0; i < num_screens; ++i) {
+		free(name_cookie[i]);
+		free(out_cookie[i]);
+		free(crtc_cookie[i]);
+		free(transform_cookie[i]);
+		free(panning_cookie[i]);
+		free(mon[i]);
+		free(res[i]);
+	}
+	free(name_cookie);
+	free(out_cookie);
+	free(crtc_cookie);
+	free(transform_cookie);
+	free(panning_cookie);
+	free(xine_reply);
+	free(xrm);
+	free(primary);
+	free(res);
+	free(res_cookie);
+	free(prim_cookie);
+	free(mon);
+	free(mon_cookie);
+	free(screens);
+
+	return num_screens;
+}
+
+static int fast_xcb_dpi(FILE *out)
+{
+	report(targeted_query() ? NULL : out, "** xcb interfaces (fast)\n");
+
+	const double start = now_ms();
+	xcb_connection_t *conn = xcb_connect(NULL, NULL);
+	if (xcb_connection_has_error(conn)) {
+		fputs("XCB connection error\n", stderr);
+		xcb_disconnect(conn);
+		return 0;
+	}
+	const double connected = now_ms();
+
+	int num_screens = do_fast_xcb_dpi(out, conn);
+
+	xcb_disconnect(conn);
+
+	/* Targeted queries only show the selected records, so the cost
+	 * goes to stderr instead */
+	FILE *stats = targeted_query() ? stderr : out;
+	report(stats, "\tround trips: %d (plus connection setup and extension data)\n",
+		fast_round_trips);
+	report(stats, "\ttime: %.1fms (connection setup: %.1fms)\n",
+		now_ms() - start, connected - start);
+
+	return num_screens;
+}
+#endif
+
+/*
+ * DRM sysfs DPI info extraction
+ */
+
+/* Without an X server (e.g. in early boot or in a greeter), we can still
+ * guess the DPI from the information the kernel exposes about each DRM
+ * connector: its status, the list of modes (preferred first) and the EDID.
+ * The root can be changed to test against a fake directory tree.
+ */
+#define DRM_SYSFS_ROOT "/sys/class/drm"
+
+/* NULL unless the sysfs backend was requested */
+const char *drm_sysfs_root = NULL;
+
+struct drm_connector
+{
+	int connection;
+	int w, h; /* preferred mode */
+	int mmw, mmh; /* physical size */
+};
+
+/* Read up to size bytes from dir/name under the sysfs root.
+ * Returns the number of bytes read, or -1 if the file could not be opened
+ */
+static long read_sysfs_file(const char *dir, const char *name,
+	unsigned char *buffer, size_t size)
+{
+	char path[STRMAX+1];
+	snprintf(path, STRMAX, "%s/%s/%s", drm_sysfs_root, dir, name);
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return -1;
+	size_t n = fread(buffer, 1, size, f);
+	fclose(f);
+	return n;
+}
+
+/* Get the preferred mode (if not known yet) and the physical size
+ * from the EDID base block
+ */
+static Bool parse_edid(const unsigned char *edid, size_t len, struct drm_connector *conn)
+{
+	static const unsigned char edid_header[8] = {
+		0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00
+	};
+
+	if (len < 128 || memcmp(edid, edid_header, sizeof(edid_header)))
+		return False;
+
+	/* Basic display parameters: maximum image size, in cm. If only one
+	 * of them is set, the other is the aspect ratio, not a size */
+	if (edid[21] && edid[22]) {
+		conn->mmw = edid[21]*10;
+		conn->mmh = edid[22]*10;
+	}
+
+	/* The first detailed timing descriptor is the preferred timing mode;
+	 * a zero pixel clock marks a display descriptor instead */
+	const unsigned char *dtd = edid + 54;
+	if (dtd[0] || dtd[1]) {
+		if (!conn->w || !conn->h) {
+			conn->w = dtd[2] | ((dtd[4] & 0xf0) << 4);
+			conn->h = dtd[5] | ((dtd[7] & 0xf0) << 4);
+		}
+		/* Image size in mm, more precise than the basic parameters */
+		int mmw = dtd[12] | ((dtd[14] & 0xf0) << 4);
+		int mmh = dtd[13] | ((dtd[14] & 0x0f) << 8);
+		if (mmw && mmh) {
+			conn->mmw = mmw;
+			conn->mmh = mmh;
+		}
+	}
+	return True;
+}
+
+/* Connector directories are named card<N>-<connector> */
+static int drm_connector_filter(const struct dirent *entry)
+{
+	return !strncmp(entry->d_name, "card", 4) && strchr(entry->d_name, '-');
+}
+
+/* Collect the connector information as a single screen, so that it can be
+ * presented by print_scaling_factors, and return the number of screens
+ */
+static int drm_dpi(FILE *out)
+{
+	struct dirent **entries = NULL;
+	int num_entries = scandir(drm_sysfs_root, &entries, drm_connector_filter, alphasort);
+	if (num_entries < 0) {
+		fprintf(stderr, "Could not read DRM connectors from %s\n", drm_sysfs_root);
+		return 0;
+	}
+
+	reference_dpi = calloc(1, sizeof(*reference_dpi));
+	noutput = calloc(1, sizeof(*noutput));
+	nmon = calloc(1, sizeof(*nmon));
+	output_dpi = calloc(1, sizeof(*output_dpi));
+	monitor_dpi = calloc(1, sizeof(*monitor_dpi));
+	output_dpi[0] = calloc(num_entries, sizeof(**output_dpi));
+
+	if (!reference_dpi || !noutput || !nmon || !output_dpi || !monitor_dpi || !output_dpi[0])
+		error("out of memory during DRM DPI information retrieval");
+
+	/* There is no core DPI without an X server: use the X default */
+	reference_dpi[0] = 96;
+	noutput[0] = num_entries;
+
+	if (!targeted_query())
+		report(out, "DRM connectors (%s):\n", drm_sysfs_root);
+
+	Bool have_primary = False;
+	unsigned char buffer[4096];
+	for (int k = 0; k < num_entries; ++k) {
+		const char *dir = entries[k]->d_name;
+		const char *name = strchr(dir, '-') + 1;
+		struct named_dpi *rec = output_dpi[0] + k;
+		struct drm_connector conn = { .connection = RR_UnknownConnection };
+
+		rec->dpi = -1;
+		rec->connection = RR_UnknownConnection;
+		strncpy(rec->name, name, STRMAX);
+
+		long len = read_sysfs_file(dir, "status", buffer, sizeof(buffer) - 1);
+		if (len < 0)
+			continue; /* not a connector */
+		buffer[len] = '\0';
+		if (!strncmp((char*)buffer, "connected", 9))
+			conn.connection = RR_Connected;
+		else if (!strncmp((char*)buffer, "disconnected", 12))
+			conn.connection = RR_Disconnected;
+		rec->connection = conn.connection;
+
+		if (conn.connection == RR_Disconnected)
+			continue;
+
+		len = read_sysfs_file(dir, "modes", buffer, sizeof(buffer) - 1);
+		if (len > 0) {
+			buffer[len] = '\0';
+			if (sscanf((char*)buffer, "%dx%d", &conn.w, &conn.h) != 2)
+				conn.w = conn.h = 0;
+		}
+
+		len = read_sysfs_file(dir, "edid", buffer, sizeof(buffer));
+		if (len > 0 && !parse_edid(buffer, len, &conn))
+			fprintf(stderr, "%s: invalid EDID\n", name);
+
+		if (!conn.w || !conn.h)
+			continue; /* no usable mode */
+
+		/* There is no primary output in DRM: pick the first active one */
+		rec->primary = !have_primary;
+		have_primary = True;
+		rec->width = conn.w;
+		rec->height = conn.h;
+		rec->mmw = conn.mmw;
+		rec->mmh = conn.mmh;
+		rec->dpi = print_dpi_randr(output_selected(name) ? out : NULL,
+			name, conn.mmw, conn.mmh, conn.w, conn.h,
+			0, rec->primary, conn.connection);
+		if (sel.output && output_selected(name))
+			++sel.found;
+	}
+
+	for (int k = 0; k < num_entries; ++k)
+		free(entries[k]);
+	free(entries);
+
+	return 1;
+}
+
+#if WITH_WAYLAND
+/*
+ * Wayland output info extraction
+ */
+
+/* Under XWayland, RANDR only describes what the compositor chooses to
+ * expose to X11 clients, which may hide the scale and the physical size.
+ * Native Wayland clients get the current mode, physical size and integer
+ * scale of each output from wl_output, and the logical geometry (which
+ * reflects fractional scaling) from xdg-output.
+ */
+
+Bool wayland_mode = False;
+
+struct wayland_output
+{
+	struct wl_output *output;
+	struct zxdg_output_v1 *xdg_output;
+	uint32_t version;
+	int transform;
+	int mmw, mmh; /* physical size */
+	int w, h; /* current mode */
+	int scale;
+	int lx, ly, lw, lh; /* logical geometry, from xdg-output */
+	char name[STRMAX+1];
+	struct wayland_output *next;
+};
+
+struct wayland_state
+{
+	struct zxdg_output_manager_v1 *xdg_output_manager;
+	struct wayland_output *head, **tail;
+	int count;
+};
+
+static void wayland_output_geometry(void *data, struct wl_output *output,
+	int32_t x, int32_t y, int32_t mmw, int32_t mmh, int32_t subpixel,
+	const char *make, const char *model, int32_t transform)
+{
+	struct wayland_output *wo = data;
+	(void)output; (void)x; (void)y; (void)subpixel; (void)make; (void)model;
+	wo->mmw = mmw;
+	wo->mmh = mmh;
+	wo->transform = transform;
+}
+
+static void wayland_output_mode(void *data, struct wl_output *output,
+	uint32_t flags, int32_t w, int32_t h, int32_t refresh)
+{
+	struct wayland_output *wo = data;
+	(void)output; (void)refresh;
+	if (flags & WL_OUTPUT_MODE_CURRENT) {
+		wo->w = w;
+		wo->h = h;
+	}
+}
+
+static void wayland_output_scale(void *data, struct wl_output *output, int32_t factor)
+{
+	struct wayland_output *wo = data;
+	(void)output;
+	wo->scale = factor;
+}
+
+static void wayland_output_name(void *data, struct wl_output *output, const char *name)
+{
+	struct wayland_output *wo = data;
+	(void)output;
+	/* the xdg-output name, if any, is the same: keep the first one */
+	if (!*wo->name)
+		strncpy(wo->name, name, STRMAX);
+}
+
+static void wayland_output_description(void *data, struct wl_output *output,
+	const char *description)
+{
+	(void)data; (void)output; (void)description;
+}
+
+static void wayland_output_done(void *data, struct wl_output *output)
+{
+	(void)data; (void)output;
+}
+
+static const struct wl_output_listener wayland_output_listener = {
+	.geometry = wayland_output_geometry,
+	.mode = wayland_output_mode,
+	.done = wayland_output_done,
+	.scale = wayland_output_scale,
+	.name = wayland_output_name,
+	.description = wayland_output_description,
+};
+
+static void wayland_xdg_output_logical_position(void *data,
+	struct zxdg_output_v1 *xdg_output, int32_t x, int32_t y)
+{
+	struct wayland_output *wo = data;
+	(void)xdg_output;
+	wo->lx = x;
+	wo->ly = y;
+}
+
+static void wayland_xdg_output_logical_size(void *data,
+	struct zxdg_output_v1 *xdg_output, int32_t w, int32_t h)
+{
+	struct wayland_output *wo = data;
+	(void)xdg_output;
+	wo->lw = w;
+	wo->lh = h;
+}
+
+static void wayland_xdg_output_name(void *data, struct zxdg_output_v1 *xdg_output,
+	const char *name)
+{
+	struct wayland_output *wo = data;
+	(void)xdg_output;
+	if (!*wo->name)
+		strncpy(wo->name, name, STRMAX);
+}
+
+static void wayland_xdg_output_description(void *data, struct zxdg_output_v1 *xdg_output,
+	const char *description)
+{
+	(void)data; (void)xdg_output; (void)description;
+}
+
+static void wayland_xdg_output_done(void *data, struct zxdg_output_v1 *xdg_output)
+{
+	(void)data; (void)xdg_output;
+}
+
+static const struct zxdg_output_v1_listener wayland_xdg_output_listener = {
+	.logical_position = wayland_xdg_output_logical_position,
+	.logical_size = wayland_xdg_output_logical_size,
+	.done = wayland_xdg_output_done,
+	.name = wayland_xdg_output_name,
+	.description = wayland_xdg_output_description,
+};
+
+/* Outputs are bound as soon as they are announced, so that their
+ * information comes in with the xdg-output one in the next round trip
+ */
+static void wayland_registry_global(void *data, struct wl_registry *registry,
+	uint32_t id, const char *interface, uint32_t version)
+{
+	struct wayland_state *state = data;
+
+	if (!strcmp(interface, wl_output_interface.name)) {
+		struct wayland_output *wo = calloc(1, sizeof(*wo));
+		if (!wo)
+			error("out of memory during Wayland output information retrieval");
+		/* version 2 has the scale, version 4 the name */
+		wo->version = version < 4 ? version : 4;
+		wo->scale = 1;
+		wo->output = wl_registry_bind(registry, id, &wl_output_interface, wo->version);
+		wl_output_add_listener(wo->output, &wayland_output_listener, wo);
+		*state->tail = wo;
+		state->tail = &wo->next;
+		++state->count;
+	} else if (!strcmp(interface, zxdg_output_manager_v1_interface.name)) {
+		/* version 2 has the output name */
+		state->xdg_output_manager = wl_registry_bind(registry, id,
+			&zxdg_output_manager_v1_interface, version < 3 ? version : 3);
+	}
+}
+
+static void wayland_registry_global_remove(void *data, struct wl_registry *registry, uint32_t id)
+{
+	(void)data; (void)registry; (void)id;
+}
+
+static const struct wl_registry_listener wayland_registry_listener = {
+	.global = wayland_registry_global,
+	.global_remove = wayland_registry_global_remove,
+};
+
+/* Collect the output information as a single screen, like drm_dpi,
+ * and return the number of screens
+ */
+static int wayland_dpi(FILE *out)
+{
+	struct wl_display *display = wl_display_connect(NULL);
+	if (!display) {
+		fputs("Could not connect to the Wayland display\n", stderr);
+		return 0;
+	}
+
+	struct wayland_state state = { .xdg_output_manager = NULL };
+	state.tail = &state.head;
+
+	const double start = now_ms();
+
+	/* First round trip: the globals, binding the outputs on the go */
+	struct wl_registry *registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &wayland_registry_listener, &state);
+	wl_display_roundtrip(display);
+
+	/* Second round trip: the wl_output and xdg-output information
+	 * for all outputs */
+	if (state.xdg_output_manager) {
+		for (struct wayland_output *wo = state.head; wo; wo = wo->next) {
+			wo->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+				state.xdg_output_manager, wo->output);
+			zxdg_output_v1_add_listener(wo->xdg_output,
+				&wayland_xdg_output_listener, wo);
+		}
+	}
+	wl_display_roundtrip(display);
+
+	reference_dpi = calloc(1, sizeof(*reference_dpi));
+	noutput = calloc(1, sizeof(*noutput));
+	nmon = calloc(1, sizeof(*nmon));
+	output_dpi = calloc(1, sizeof(*output_dpi));
+	monitor_dpi = calloc(1, sizeof(*monitor_dpi));
+	output_dpi[0] = calloc(state.count ? state.count : 1, sizeof(**output_dpi));
+
+	if (!reference_dpi || !noutput || !nmon || !output_dpi || !monitor_dpi || !output_dpi[0])
+		error("out of memory during Wayland output information retrieval");
+
+	/* Scale 1 is meant for 96 DPI, as in X11 */
+	reference_dpi[0] = 96;
+	noutput[0] = state.count;
+
+	if (!targeted_query())
+		report(out, "Wayland outputs%s:\n", state.xdg_output_manager ? "" :
+			" (no xdg-output, logical geometry unknown)");
+
+	int k = 0;
+	for (struct wayland_output *wo = state.head; wo; wo = wo->next, ++k) {
+		struct named_dpi *rec = output_dpi[0] + k;
+		if (!*wo->name)
+			snprintf(wo->name, STRMAX, "wl_output-%d", k);
+		memcpy(rec->name, wo->name, sizeof(rec->name));
+
+		/* The mode and physical size are those of the panel: swap them
+		 * for 90 and 270 degree transforms (flipped or not), as RANDR does */
+		const int rotated = wo->transform & 1;
+		const int w = rotated ? wo->h : wo->w;
+		const int h = rotated ? wo->w : wo->h;
+		const int mmw = rotated ? wo->mmh : wo->mmw;
+		const int mmh = rotated ? wo->mmw : wo->mmh;
+
+		/* Without xdg-output, assume the logical size follows the integer scale */
+		if (!wo->lw || !wo->lh) {
+			wo->lw = w/wo->scale;
+			wo->lh = h/wo->scale;
+		}
+		rec->x = wo->lx;
+		rec->y = wo->ly;
+		rec->width = wo->lw;
+		rec->height = wo->lh;
+		rec->mmw = mmw;
+		rec->mmh = mmh;
+
+		/* There is no primary output in Wayland: pick the first one */
+		rec->primary = k == 0;
+
+		const Bool selected = output_selected(rec->name);
+		FILE *rec_out = selected ? out : NULL;
+		rec->dpi = print_dpi_randr(rec_out, rec->name, mmw, mmh, w, h,
+			rotated, rec->primary, RR_Connected);
+		report(rec_out, "\t\t\tscale %d, logical %dx%d+%d+%d: %.3g pixels per logical pixel\n",
+			wo->scale, wo->lw, wo->lh, wo->lx, wo->ly,
+			wo->lw ? (double)w/wo->lw : 0.0);
+		if (sel.output && selected)
+			++sel.found;
+	}
+
+	if (!targeted_query())
+		report(out, "\ttime: %.1fms\n", now_ms() - start);
+
+	while (state.head) {
+		struct wayland_output *wo = state.head;
+		state.head = wo->next;
+		if (wo->xdg_output)
+			zxdg_output_v1_destroy(wo->xdg_output);
+		if (wo->version >= WL_OUTPUT_RELEASE_SINCE_VERSION)
+			wl_output_release(wo->output);
+		else
+			wl_output_destroy(wo->output);
+		free(wo);
+	}
+	if (state.xdg_output_manager)
+		zxdg_output_manager_v1_destroy(state.xdg_output_manager);
+	wl_registry_destroy(registry);
+	wl_display_disconnect(display);
+
+	return 1;
+}
+#endif
+
+struct scaling_factor
+{
+	int min;
+	float actual;
+	int round;
+	int max;
+};
+
+static inline
+struct scaling_factor calc_scaling(float actual)
+{
+	struct scaling_factor ret = {
+		.min = (int)floor(actual),
+		.actual = actual,
+		.round = (int)round(actual),
+		.max = (int)ceil(actual)
+	};
+
+	if (ret.min < 1) ret.min = 1;
+	if (ret.round < 1) ret.round = 1;
+	if (ret.max < 1) ret.max = 1;
+
+	return ret;
+}
+
+static inline
+void print_scaling_factor(FILE *out, struct scaling_factor scaling)
+{
+	fprintf(out, "%d %.2g %d %d",
+		scaling.min, scaling.actual, scaling.round, scaling.max);
+}
+
+/* DPI of the primary output or monitor. If none is marked as primary,
+ * the first one with a valid DPI is used instead.
+ */
+static int primary_dpi(const struct named_dpi *list, int count)
+{
+	int fallback = 0;
+	for (int k = count - 1; k >= 0; --k) {
+		if (list[k].dpi <= 0)
+			continue;
+		if (list[k].primary)
+			return list[k].dpi;
+		fallback = list[k].dpi;
+	}
+	return fallback;
+}
+
+/* Scaling of an output or monitor with the given DPI, prorated so that the
+ * primary one gets the reference scaling. When no output reports its size
+ * (prim_dpi is 0), there is nothing to prorate to, and the reference is used.
+ */
+static inline float prorated_scaling(float reference, int dpi, int prim_dpi)
+{
+	return prim_dpi > 0 ? (reference*dpi)/prim_dpi : reference;
+}
+
+static void print_scaling_record(FILE *out, const struct named_dpi *rec,
+	float reference, int prim_dpi)
+{
+	fprintf(out, "\t\t%s:\n", rec->name);
+	float native = rec->dpi/96.0f;
+	float rated = prorated_scaling(reference, rec->dpi, prim_dpi);
+	fputs("\t\t\tnative: ", out);
+	print_scaling_factor(out, calc_scaling(native));
+	fputs("\n\t\t\tprorated: ", out);
+	print_scaling_factor(out, calc_scaling(rated));
+	fputc('\n', out);
+}
+
+static void print_scaling_list(FILE *out, const char *header, float reference,
+	const struct named_dpi *list, int count, Bool (*selected)(const char *))
+{
+	const int prim_dpi = primary_dpi(list, count);
+	Bool printed_hdr = False;
+	for (int k = 0; k < count; ++k) {
+		int dpi = list[k].dpi;
+		if (dpi < 0) continue; /* output is not connected */
+		if (!selected(list[k].name)) continue;
+		if (!printed_hdr) {
+			fprintf(out, "\t%s:\n", header);
+			printed_hdr = True;
+		}
+		print_scaling_record(out, list + k, reference, prim_dpi);
+	}
+}
+
+void print_scaling_factors(FILE *out, int num_screens)
+{
+	for (int i = 0; i < num_screens; ++i) {
+		if (!screen_selected(i))
+			continue;
+
+		fprintf(out, "Screen %d:\n", i);
+		float reference = reference_dpi[i]/96.0f;
+		if (!targeted_query()) {
+			fputs("\treference scaling: ", out);
+			print_scaling_factor(out, calc_scaling(reference));
+			fputc('\n', out);
+		}
+
+		if (nmon[i])
+			print_scaling_list(out, "monitors", reference,
+				monitor_dpi[i], nmon[i], monitor_selected);
+
+		if (noutput[i])
+			print_scaling_list(out, "outputs", reference,
+				output_dpi[i], noutput[i], output_selected);
+	}
+}
+
+/* Release the information collected by do_xlib_dpi */
+void free_dpi_info(int num_screens)
+{
+	if (monitor_dpi) for (int i = 0; i < num_screens; ++i)
+		free(monitor_dpi[i]);
+	if (output_dpi) for (int i = 0; i < num_screens; ++i)
+		free(output_dpi[i]);
+	free(monitor_dpi);
+	free(output_dpi);
+	free(reference_dpi);
+	free(config_time);
+	free(nmon);
+	free(noutput);
+	free(monitor_cap);
+	free(output_cap);
+	monitor_dpi = output_dpi = NULL;
+	reference_dpi = NULL;
+	config_time = NULL;
+	nmon = noutput = NULL;
+	monitor_cap = output_cap = NULL;
+	dpi_info_screens = 0;
+}
+
+/*
+ * Change journal
+ */
+
+/* With --journal FILE, a compact binary record of every snapshot is
+ * appended to FILE, so that the topology and scaling in effect at a given
+ * time can be recovered after the fact (e.g. to investigate a report of
+ * the UI becoming huge after undocking). The file is a fixed-size ring
+ * buffer mapped in memory: appending only writes to the mapping, and the
+ * oldest records are dropped to make room. --journal-dump FILE decodes it.
+ *
+ * All fields are in native byte order; records never wrap around the end
+ * of the ring: a zero size marks the rest of the ring as unused.
+ */
+#define JOURNAL_MAGIC "XDPIJNL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_DEFAULT_SIZE (1024*1024)
+
+struct journal_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t capacity; /* size of the ring, following the header */
+	/* Logical offsets, only growing: the ring position is modulo capacity */
+	uint64_t head; /* end of the newest record */
+	uint64_t tail; /* start of the oldest record */
+	uint64_t seq; /* number of records appended so far */
+	unsigned char reserved[24];
+};
+
+/* One per screen per snapshot, followed by its outputs */
+struct journal_record
+{
+	uint32_t size; /* including the outputs, multiple of 8 */
+	uint32_t seq;
+	int64_t time_us; /* wall clock, in microseconds since the epoch */
+	uint32_t config_time; /* RANDR configuration timestamp, 0 if unknown */
+	float reference_dpi;
+	uint16_t screen;
+	uint16_t noutput;
+	uint32_t flags;
+};
+
+/* The snapshot does not come from RANDR (DRM, Wayland), so there is no
+ * configuration timestamp
+ */
+#define JOURNAL_NO_CONFIG_TIME 1
+
+/* Followed by the name (not NUL-terminated), padded to 4 bytes */
+struct journal_output
+{
+	int16_t x, y;
+	uint16_t width, height;
+	uint16_t mmw, mmh;
+	int16_t dpi; /* -1 if not active */
+	uint16_t scale; /* native scaling factor, in hundredths */
+	uint8_t primary;
+	uint8_t connection;
+	uint8_t name_len;
+	uint8_t reserved;
+};
+
+const char *journal_file = NULL;
+const char *journal_dump_file = NULL;
+long journal_size = JOURNAL_DEFAULT_SIZE;
+
+/* The mapped journal, NULL unless --journal was given */
+struct journal_header *journal = NULL;
+
+static inline unsigned char *journal_ring(struct journal_header *hdr)
+{
+	return (unsigned char*)hdr + sizeof(*hdr);
+}
+
+/* Map the journal, creating it with the given ring size if needed.
+ * Returns NULL (after reporting why) if it cannot be used
+ */
+static struct journal_header *journal_map(const char *path, long size, Bool create)
+{
+	const int fd = open(path, create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	struct journal_header *hdr = NULL;
+	off_t len = lseek(fd, 0, SEEK_END);
+	if (len == 0 && create) {
+		len = sizeof(*hdr) + size;
+		if (ftruncate(fd, len)) {
+			perror(path);
+			close(fd);
+			return NULL;
+		}
+	}
+	if (len < (off_t)sizeof(*hdr)) {
+		fprintf(stderr, "%s: not an xdpi journal\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	void *map = mmap(NULL, len, create ? PROT_READ | PROT_WRITE : PROT_READ,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return NULL;
+	}
+	hdr = map;
+
+	/* A new file is all zeros */
+	if (create && !hdr->magic[0] && !hdr->capacity) {
+		memcpy(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic));
+		hdr->version = JOURNAL_VERSION;
+		hdr->capacity = len - sizeof(*hdr);
+	}
+
+	if (memcmp(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic)) ||
+		hdr->version != JOURNAL_VERSION ||
+		hdr->capacity != (uint64_t)(len - sizeof(*hdr)) ||
+		hdr->capacity % 8 || hdr->tail > hdr->head ||
+		hdr->head - hdr->tail > hdr->capacity) {
+		fprintf(stderr, "%s: not an xdpi journal, or a corrupted one\n", path);
+		munmap(map, len);
+		return NULL;
+	}
+	return hdr;
+}
+
+/* Drop the oldest records that would be overwritten by writing up to
+ * the logical offset end
+ */
+static void journal_evict(struct journal_header *hdr, uint64_t end)
+{
+	const unsigned char *ring = journal_ring(hdr);
+	while (hdr->tail + hdr->capacity < end) {
+		const uint64_t pos = hdr->tail % hdr->capacity;
+		uint32_t size;
+		memcpy(&size, ring + pos, sizeof(size));
+		hdr->tail += size ? size : hdr->capacity - pos;
+	}
+}
+
+/* Make room for a record of the given size, returning where to write it */
+static unsigned char *journal_reserve(struct journal_header *hdr, uint32_t size)
+{
+	unsigned char *ring = journal_ring(hdr);
+	const uint32_t room = hdr->capacity - hdr->head % hdr->capacity;
+	if (room < size) {
+		const uint32_t skip = 0;
+		journal_evict(hdr, hdr->head + room);
+		memcpy(ring + hdr->head % hdr->capacity, &skip, sizeof(skip));
+		hdr->head += room;
+	}
+	journal_evict(hdr, hdr->head + size);
+	return ring + hdr->head % hdr->capacity;
+}
+
+static inline uint32_t journal_output_size(const struct named_dpi *rec)
+{
+	const size_t name_len = strnlen(rec->name, UINT8_MAX);
+	return pad_to_int32(sizeof(struct journal_output) + name_len);
+}
+
+/* Record the information collected for each screen */
+static void journal_append(int num_screens)
+{
+	if (!journal)
+		return;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	const int64_t time_us = (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+
+	for (int i = 0; i < num_screens; ++i) {
+		const int count = noutput[i] < UINT16_MAX ? noutput[i] : UINT16_MAX;
+		uint32_t size = sizeof(struct journal_record);
+		for (int o = 0; o < count; ++o)
+			size += journal_output_size(output_dpi[i] + o);
+		size = (size + 7) & ~7u;
+		if (size > journal->capacity) {
+			fprintf(stderr, "screen %d: %u bytes record does not fit in the journal\n", i, size);
+			continue;
+		}
+
+		unsigned char *p = journal_reserve(journal, size);
+		const struct journal_record record = {
+			.size = size,
+			.seq = journal->seq,
+			.time_us = time_us,
+			.config_time = config_time ? config_time[i] : 0,
+			.reference_dpi = reference_dpi[i],
+			.screen = i,
+			.noutput = count,
+			.flags = config_time ? 0 : JOURNAL_NO_CONFIG_TIME
+		};
+		memcpy(p, &record, sizeof(record));
+		p += sizeof(record);
+
+		for (int o = 0; o < count; ++o) {
+			const struct named_dpi *rec = output_dpi[i] + o;
+			const struct journal_output entry = {
+				.x = rec->x,
+				.y = rec->y,
+				.width = rec->width,
+				.height = rec->height,
+				.mmw = rec->mmw,
+				.mmh = rec->mmh,
+				.dpi = rec->dpi,
+				.scale = rec->dpi > 0 ? (uint16_t)lround(rec->dpi*100/96.0) : 0,
+				.primary = rec->primary,
+				.connection = rec->connection,
+				.name_len = strnlen(rec->name, UINT8_MAX)
+			};
+			memcpy(p, &entry, sizeof(entry));
+			memcpy(p + sizeof(entry), rec->name, entry.name_len);
+			p += journal_output_size(rec);
+		}
+
+		/* Only make the record visible once it is complete */
+		journal->head += size;
+		++journal->seq;
+	}
+}
+
+/* Decode the records from the oldest to the newest.
+ * Returns the exit code
+ */
+static int journal_dump(const char *path)
+{
+	struct journal_header *hdr = journal_map(path, 0, False);
+	if (!hdr)
+		return 1;
+
+	const unsigned char *ring = journal_ring(hdr);
+	printf("%s: %u bytes, %llu records written, %llu bytes in use\n", path,
+		hdr->capacity, (unsigned long long)hdr->seq,
+		(unsigned long long)(hdr->head - hdr->tail));
+
+	uint64_t off = hdr->tail;
+	while (off < hdr->head) {
+		const uint64_t pos = off % hdr->capacity;
+		const uint64_t avail = hdr->capacity - pos;
+		struct journal_record record;
+		uint32_t size;
+		memcpy(&size, ring + pos, sizeof(size));
+		if (!size) {
+			off += avail;
+			continue;
+		}
+		if (size < sizeof(record) || size > avail || size > hdr->head - off) {
+			fprintf(stderr, "%s: corrupted record at offset %llu\n",
+				path, (unsigned long long)off);
+			return 1;
+		}
+		memcpy(&record, ring + pos, sizeof(record));
+
+		const time_t secs = record.time_us/1000000;
+		struct tm tm;
+		char when[64];
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&secs, &tm));
+		char config[32] = "n/a";
+		if (!(record.flags & JOURNAL_NO_CONFIG_TIME))
+			snprintf(config, sizeof(config), "%u", record.config_time);
+		printf("#%u %s.%03d screen %u: config time %s, reference %g DPI, %u outputs\n",
+			record.seq, when, (int)(record.time_us % 1000000)/1000,
+			record.screen, config, record.reference_dpi, record.noutput);
+
+		const unsigned char *p = ring + pos + sizeof(record);
+		const unsigned char *end = ring + pos + size;
+		for (unsigned o = 0; o < record.noutput; ++o) {
+			struct journal_output entry;
+			if ((size_t)(end - p) < sizeof(entry))
+				break;
+			memcpy(&entry, p, sizeof(entry));
+			const size_t entry_size = pad_to_int32(sizeof(entry) + entry.name_len);
+			if ((size_t)(end - p) < entry_size)
+				break;
+			const char *name = (const char*)p + sizeof(entry);
+			p += entry_size;
+
+			const char *connection = entry.connection == RR_Connected ? "connected" :
+				entry.connection == RR_Disconnected ? "disconnected" : "unknown";
+			if (entry.dpi < 0) {
+				printf("\t%.*s (%s)\n", entry.name_len, name, connection);
+				continue;
+			}
+			printf("\t%.*s (%s%s): %ux%u+%d+%d, %ux%u mm, %d DPI, scale %.2f\n",
+				entry.name_len, name, connection, entry.primary ? ", primary" : "",
+				entry.width, entry.height, entry.x, entry.y,
+				entry.mmw, entry.mmh, entry.dpi, entry.scale/100.0);
+		}
+		off += size;
+	}
+	return 0;
+}
+
+#if WITH_XCB
+/*
+ * Asynchronous interface
+ */
+
+/* For window managers, panels and other programs running their own event
+ * loop: the queries of the fast pass, run as a state machine on a dedicated
+ * connection. Whenever the connection fd is readable, xdpi_async_dispatch
+ * takes the replies and events that already arrived, sends the requests
+ * they make possible, and reports each complete snapshot (or the changes
+ * from the previous one) through the callback. A new snapshot is taken on
+ * every RANDR or X resources change.
+ *
+ * Only xdpi_async_new blocks, to connect to the server. Dispatching never
+ * waits for replies, but sending the requests can still block, in write(),
+ * while the socket buffer is full: xcb has no non-blocking flush. This only
+ * happens if the server stops reading (a stalled server or proxy), since a
+ * snapshot takes a few kilobytes of requests at most. The interface can be
+ * embedded by including xdpi.c with main renamed, as xdpi-epoll.c does.
+ */
+
+/* The same information as the globals filled by the synchronous passes */
+struct xdpi_snapshot
+{
+	int num_screens;
+	float *reference_dpi;
+	int *noutput;
+	struct named_dpi **output_dpi;
+	int *nmon;
+	struct named_dpi **monitor_dpi;
+};
+
+enum xdpi_change_kind
+{
+	XDPI_ADDED,
+	XDPI_REMOVED,
+	XDPI_MODIFIED
+};
+
+/* A change of an active output or monitor */
+struct xdpi_change
+{
+	enum xdpi_change_kind kind;
+	int screen;
+	Bool monitor;
+	/* The new record, or the last one if it was removed */
+	const struct named_dpi *rec;
+	/* As computed by print_scaling_record */
+	struct scaling_factor native, prorated;
+};
+
+/* Report the changes rather than whole snapshots */
+#define XDPI_ASYNC_DELTAS 1
+
+/* Called with a NULL change for each snapshot, or, with XDPI_ASYNC_DELTAS,
+ * once per change since the previous snapshot
+ */
+typedef void (*xdpi_async_callback)(void *data, const struct xdpi_snapshot *snap,
+	const struct xdpi_change *change);
+
+enum xdpi_async_state
+{
+	XDPI_ASYNC_EXTENSION, /* waiting for the RANDR extension data */
+	XDPI_ASYNC_SCREENS, /* waiting for the screen resources, primary outputs,
+			       monitors and X resources */
+	XDPI_ASYNC_OUTPUTS, /* waiting for the outputs, CRTCs and monitor names */
+	XDPI_ASYNC_IDLE, /* waiting for changes */
+	XDPI_ASYNC_FAILED
+};
+
+/* A request whose reply is awaited */
+struct xdpi_async_request
+{
+	unsigned int sequence;
+	void *reply; /* NULL on error */
+};
+
+struct xdpi_async
+{
+	xcb_connection_t *conn;
+	enum xdpi_async_state state;
+	unsigned flags;
+	xdpi_async_callback callback;
+	void *data;
+
+	int num_screens;
+	xcb_screen_t *screens;
+	uint8_t rr_event_base;
+	Bool changed; /* since the current query was started */
+
+	/* The requests of the current state, in the order they were sent
+	 * (and their replies arrive), and those of the screens state, which
+	 * are still needed in the outputs one */
+	struct xdpi_async_request *req;
+	int nreq, next_req;
+	struct xdpi_async_request *screen_req;
+
+	struct xdpi_snapshot snap;
+};
+
+static void xdpi_snapshot_free(struct xdpi_snapshot *snap)
+{
+	for (int i = 0; i < snap->num_screens; ++i) {
+		if (snap->output_dpi)
+			free(snap->output_dpi[i]);
+		if (snap->monitor_dpi)
+			free(snap->monitor_dpi[i]);
+	}
+	free(snap->reference_dpi);
+	free(snap->noutput);
+	free(snap->output_dpi);
+	free(snap->nmon);
+	free(snap->monitor_dpi);
+	memset(snap, 0, sizeof(*snap));
+}
+
+static void xdpi_async_free_requests(struct xdpi_async_request *req, int count)
+{
+	if (req) for (int r = 0; r < count; ++r)
+		free(req[r].reply);
+	free(req);
+}
+
+/* Start a new state expecting count replies */
+static struct xdpi_async_request *xdpi_async_expect(struct xdpi_async *a,
+	enum xdpi_async_state state, int count)
+{
+	xdpi_async_free_requests(a->req, a->nreq);
+	a->req = calloc(count + 1, sizeof(*a->req));
+	if (!a->req)
+		error("out of memory for asynchronous requests");
+	a->nreq = count;
+	a->next_req = 0;
+	a->state = state;
+	return a->req;
+}
+
+/* Collect the replies that arrived, in order. Returns True once all did */
+static Bool xdpi_async_poll(struct xdpi_async *a)
+{
+	while (a->next_req < a->nreq) {
+		struct xdpi_async_request *r = a->req + a->next_req;
+		xcb_generic_error_t *err = NULL;
+		if (!xcb_poll_for_reply(a->conn, r->sequence, &r->reply, &err))
+			return False;
+		free(err);
+		++a->next_req;
+	}
+	return True;
+}
+
+/* Take note of the changes, returning the number of events processed */
+static int xdpi_async_events(struct xdpi_async *a)
+{
+	int count = 0;
+	xcb_generic_event_t *ev;
+	while ((ev = xcb_poll_for_event(a->conn))) {
+		const uint8_t type = ev->response_type & ~0x80;
+		if (a->rr_event_base && (type == a->rr_event_base + XCB_RANDR_SCREEN_CHANGE_NOTIFY ||
+			type == a->rr_event_base + XCB_RANDR_NOTIFY))
+			a->changed = True;
+		else if (type == XCB_PROPERTY_NOTIFY &&
+			((xcb_property_notify_event_t*)ev)->atom == XCB_ATOM_RESOURCE_MANAGER)
+			a->changed = True;
+		free(ev);
+		++count;
+	}
+	return count;
+}
+
+/* Everything that does not depend on other replies, as in the fast pass */
+static void xdpi_async_query_screens(struct xdpi_async *a)
+{
+	const int n = a->num_screens;
+	struct xdpi_async_request *req = xdpi_async_expect(a, XDPI_ASYNC_SCREENS, 3*n + 1);
+	for (int i = 0; i < n; ++i) {
+		const xcb_window_t root = a->screens[i].root;
+		req[3*i].sequence = xcb_randr_get_screen_resources_current(a->conn, root).sequence;
+		req[3*i + 1].sequence = xcb_randr_get_output_primary(a->conn, root).sequence;
+		req[3*i + 2].sequence = xcb_randr_get_monitors(a->conn, root, 1).sequence;
+	}
+	req[3*n].sequence = xcb_get_property(a->conn, 0, a->screens[0].root,
+		XCB_ATOM_RESOURCE_MANAGER, XCB_ATOM_STRING, 0, 0x1000000).sequence;
+	a->changed = False;
+}
+
+static void xdpi_async_setup(struct xdpi_async *a)
+{
+	const xcb_query_extension_reply_t *ext = a->req[0].reply;
+	if (!ext || !ext->present) {
+		fputs("RANDR is required for asynchronous DPI tracking\n", stderr);
+		a->state = XDPI_ASYNC_FAILED;
+		return;
+	}
+	a->rr_event_base = ext->first_event;
+
+	/* Requests are processed in order, so the version is set before
+	 * the other requests need it */
+	xcb_discard_reply(a->conn, xcb_randr_query_version(a->conn, 1, 5).sequence);
+	for (int i = 0; i < a->num_screens; ++i)
+		xcb_randr_select_input(a->conn, a->screens[i].root,
+			XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+			XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
+			XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE);
+	const uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+	xcb_change_window_attributes(a->conn, a->screens[0].root, XCB_CW_EVENT_MASK, &mask);
+
+	xdpi_async_query_screens(a);
+}
+
+/* Output and CRTC information and monitor names, for all screens at once */
+static void xdpi_async_query_outputs(struct xdpi_async *a)
+{
+	/* The screen replies are needed to build the snapshot */
+	xdpi_async_free_requests(a->screen_req, 3*a->num_screens + 1);
+	struct xdpi_async_request *screen_req = a->screen_req = a->req;
+	a->req = NULL;
+	a->nreq = 0;
+
+	int count = 0;
+	for (int i = 0; i < a->num_screens; ++i) {
+		const xcb_randr_get_screen_resources_current_reply_t *res = screen_req[3*i].reply;
+		const xcb_randr_get_monitors_reply_t *mon = screen_req[3*i + 2].reply;
+		if (res)
+			count += xcb_randr_get_screen_resources_current_outputs_length(res) +
+				xcb_randr_get_screen_resources_current_crtcs_length(res);
+		if (mon)
+			count += xcb_randr_get_monitors_monitors_length(mon);
+	}
+
+	struct xdpi_async_request *req = xdpi_async_expect(a, XDPI_ASYNC_OUTPUTS, count);
+	for (int i = 0; i < a->num_screens; ++i) {
+		const xcb_randr_get_screen_resources_current_reply_t *res = screen_req[3*i].reply;
+		const xcb_randr_get_monitors_reply_t *mon = screen_req[3*i + 2].reply;
+		if (res) {
+			const int no = xcb_randr_get_screen_resources_current_outputs_length(res);
+			const int nc = xcb_randr_get_screen_resources_current_crtcs_length(res);
+			const xcb_randr_output_t *outputs = xcb_randr_get_screen_resources_current_outputs(res);
+			const xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_current_crtcs(res);
+			for (int o = 0; o < no; ++o)
+				(req++)->sequence = xcb_randr_get_output_info(a->conn,
+					outputs[o], res->config_timestamp).sequence;
+			for (int c = 0; c < nc; ++c)
+				(req++)->sequence = xcb_randr_get_crtc_info(a->conn,
+					crtcs[c], res->config_timestamp).sequence;
+		}
+		if (mon) {
+			xcb_randr_monitor_info_iterator_t it = xcb_randr_get_monitors_monitors_iterator(mon);
+			for (; it.rem; xcb_randr_monitor_info_next(&it))
+				(req++)->sequence = xcb_get_atom_name(a->conn, it.data->name).sequence;
+		}
+	}
+}
+
+/* Fill a snapshot from the replies, with the same DPI computations as
+ * the synchronous passes
+ */
+static void xdpi_async_build(struct xdpi_async *a, struct xdpi_snapshot *snap)
+{
+	const int n = a->num_screens;
+	snap->num_screens = n;
+	snap->reference_dpi = calloc(n, sizeof(*snap->reference_dpi));
+	snap->noutput = calloc(n, sizeof(*snap->noutput));
+	snap->output_dpi = calloc(n, sizeof(*snap->output_dpi));
+	snap->nmon = calloc(n, sizeof(*snap->nmon));
+	snap->monitor_dpi = calloc(n, sizeof(*snap->monitor_dpi));
+	if (!snap->reference_dpi || !snap->noutput || !snap->output_dpi ||
+		!snap->nmon || !snap->monitor_dpi)
+		error("out of memory for asynchronous DPI snapshot");
+
+	char *xft = xcb_xft_dpi(a->screen_req[3*n].reply);
+	const float xft_dpi = xft ? strtof(xft, NULL) : 0;
+	free(xft);
+
+	const struct xdpi_async_request *req = a->req;
+	for (int i = 0; i < n; ++i) {
+		const xcb_screen_t *screen = a->screens + i;
+		snap->reference_dpi[i] = xft_dpi > 0 ? xft_dpi : print_dpi_screen(NULL, i,
+			screen->width_in_pixels, screen->height_in_pixels,
+			screen->width_in_millimeters, screen->height_in_millimeters);
+
+		const xcb_randr_get_screen_resources_current_reply_t *res = a->screen_req[3*i].reply;
+		const xcb_randr_get_output_primary_reply_t *prim = a->screen_req[3*i + 1].reply;
+		const xcb_randr_get_monitors_reply_t *mon = a->screen_req[3*i + 2].reply;
+		struct output_rotations rotations = { .rotated = NULL };
+
+		if (res) {
+			const int no = xcb_randr_get_screen_resources_current_outputs_length(res);
+			const int nc = xcb_randr_get_screen_resources_current_crtcs_length(res);
+			const xcb_randr_output_t *outputs = xcb_randr_get_screen_resources_current_outputs(res);
+			const xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_current_crtcs(res);
+
+			snap->noutput[i] = no;
+			snap->output_dpi[i] = calloc(no + 1, sizeof(**snap->output_dpi));
+			if (!snap->output_dpi[i])
+				error("out of memory for output DPI");
+
+			struct xid_index crtc_index;
+			xid_index_init(&crtc_index, nc);
+			for (int c = 0; c < nc; ++c)
+				xid_index_add(&crtc_index, crtcs[c], c);
+			output_rotations_init(&rotations, no);
+
+			for (int o = 0; o < no; ++o) {
+				struct named_dpi *rec = snap->output_dpi[i] + o;
+				const xcb_randr_get_output_info_reply_t *rro = req[o].reply;
+				rec->dpi = -1;
+				if (!rro)
+					continue;
+				rec->connection = rro->connection;
+				const int name_len = rro->name_len < STRMAX ? rro->name_len : STRMAX;
+				memcpy(rec->name, xcb_randr_get_output_info_name(rro), name_len);
+				rec->name[name_len] = '\0';
+
+				const int c = xid_index_find(&crtc_index, rro->crtc);
+				const xcb_randr_get_crtc_info_reply_t *rrc = c >= 0 ? req[no + c].reply : NULL;
+				if (!rrc)
+					continue;
+				const uint16_t rot = (rrc->rotation & 0x0f);
+				const int rotated = ((rot == XCB_RANDR_ROTATION_ROTATE_90) || (rot == XCB_RANDR_ROTATION_ROTATE_270));
+				rec->mmw = rotated ? rro->mm_height : rro->mm_width;
+				rec->mmh = rotated ? rro->mm_width : rro->mm_height;
+				output_rotations_set(&rotations, outputs[o], o, rotated);
+				rec->primary = prim && prim->output == outputs[o];
+				rec->x = rrc->x;
+				rec->y = rrc->y;
+				rec->width = rrc->width;
+				rec->height = rrc->height;
+				rec->dpi = print_dpi_randr(NULL, rec->name, rec->mmw, rec->mmh,
+					rrc->width, rrc->height, rotated, rec->primary, rro->connection);
+			}
+			xid_index_free(&crtc_index);
+			req += no + nc;
+		}
+
+		if (mon) {
+			const int nm = xcb_randr_get_monitors_monitors_length(mon);
+			snap->nmon[i] = nm;
+			snap->monitor_dpi[i] = calloc(nm + 1, sizeof(**snap->monitor_dpi));
+			if (!snap->monitor_dpi[i])
+				error("out of memory for monitor DPI");
+
+			xcb_randr_monitor_info_iterator_t it = xcb_randr_get_monitors_monitors_iterator(mon);
+			for (int m = 0; it.rem; ++m, xcb_randr_monitor_info_next(&it)) {
+				const xcb_randr_monitor_info_t *mi = it.data;
+				struct named_dpi *rec = snap->monitor_dpi[i] + m;
+				char *name = fast_atom_name(req[m].reply);
+				strncpy(rec->name, name ? name : "<error>", STRMAX);
+				free(name);
+				rec->primary = mi->primary;
+				rec->x = mi->x;
+				rec->y = mi->y;
+				rec->width = mi->width;
+				rec->height = mi->height;
+				const xcb_randr_output_t *mon_outputs = xcb_randr_monitor_info_outputs(mi);
+				int rotated = -1;
+				for (int k = 0; k < xcb_randr_monitor_info_outputs_length(mi); ++k)
+					rotated = fold_rotation(rotated, &rotations, mon_outputs[k]);
+				rec->dpi = print_dpi_monitor(NULL, rec->name,
+					mi->width, mi->height,
+					mi->width_in_millimeters, mi->height_in_millimeters,
+					rotated, mi->primary, mi->automatic);
+			}
+			req += nm;
+		}
+		output_rotations_free(&rotations);
+	}
+}
+
+/* Find the active record with the given name, trying the same position first */
+static const struct named_dpi *xdpi_find_active(const struct named_dpi *list, int count,
+	int hint, const char *name)
+{
+	if (hint < count && list[hint].dpi > 0 && !strcmp(list[hint].name, name))
+		return list + hint;
+	for (int k = 0; k < count; ++k)
+		if (list[k].dpi > 0 && !strcmp(list[k].name, name))
+			return list + k;
+	return NULL;
+}
+
+static void xdpi_async_change(struct xdpi_async *a, enum xdpi_change_kind kind,
+	int screen, Bool monitor, const struct named_dpi *rec, float reference, int prim_dpi)
+{
+	const struct xdpi_change change = {
+		.kind = kind,
+		.screen = screen,
+		.monitor = monitor,
+		.rec = rec,
+		.native = calc_scaling(rec->dpi/96.0f),
+		.prorated = calc_scaling(prorated_scaling(reference, rec->dpi, prim_dpi))
+	};
+	a->callback(a->data, &a->snap, &change);
+}
+
+/* Report the changes of the outputs or monitors of a screen, from the
+ * given list of the previous snapshot (empty for the first one)
+ */
+static void xdpi_async_diff(struct xdpi_async *a, int screen, Bool monitor,
+	const struct named_dpi *old_list, int old_count, float old_reference)
+{
+	const struct xdpi_snapshot *snap = &a->snap;
+	const struct named_dpi *list = monitor ? snap->monitor_dpi[screen] : snap->output_dpi[screen];
+	const int count = monitor ? snap->nmon[screen] : snap->noutput[screen];
+	const float reference = snap->reference_dpi[screen]/96.0f;
+	const int prim_dpi = primary_dpi(list, count);
+	const int old_prim_dpi = primary_dpi(old_list, old_count);
+
+	/* The prorated factors of all records change with the reference
+	 * or the primary DPI */
+	const Bool all_changed = old_reference != reference || old_prim_dpi != prim_dpi;
+
+	for (int k = 0; k < count; ++k) {
+		const struct named_dpi *rec = list + k;
+		if (rec->dpi <= 0)
+			continue;
+		const struct named_dpi *old = xdpi_find_active(old_list, old_count, k, rec->name);
+		if (old && !all_changed && old->dpi == rec->dpi && old->primary == rec->primary &&
+			old->x == rec->x && old->y == rec->y &&
+			old->width == rec->width && old->height == rec->height)
+			continue;
+		xdpi_async_change(a, old ? XDPI_MODIFIED : XDPI_ADDED,
+			screen, monitor, rec, reference, prim_dpi);
+	}
+	for (int k = 0; k < old_count; ++k) {
+		const struct named_dpi *rec = old_list + k;
+		if (rec->dpi > 0 && !xdpi_find_active(list, count, k, rec->name))
+			xdpi_async_change(a, XDPI_REMOVED,
+				screen, monitor, rec, old_reference, old_prim_dpi);
+	}
+}
+
+static void xdpi_async_finish(struct xdpi_async *a)
+{
+	/* The previous snapshot is kept until the changes are reported */
+	struct xdpi_snapshot old = a->snap;
+	memset(&a->snap, 0, sizeof(a->snap));
+	xdpi_async_build(a, &a->snap);
+	xdpi_async_free_requests(a->screen_req, 3*a->num_screens + 1);
+	a->screen_req = NULL;
+
+	if (!(a->flags & XDPI_ASYNC_DELTAS)) {
+		a->callback(a->data, &a->snap, NULL);
+	} else for (int i = 0; i < a->num_screens; ++i) {
+		const Bool first = !old.num_screens;
+		const float old_reference = first ? 1 : old.reference_dpi[i]/96.0f;
+		xdpi_async_diff(a, i, False, first ? NULL : old.output_dpi[i],
+			first ? 0 : old.noutput[i], old_reference);
+		xdpi_async_diff(a, i, True, first ? NULL : old.monitor_dpi[i],
+			first ? 0 : old.nmon[i], old_reference);
+	}
+	xdpi_snapshot_free(&old);
+
+	if (a->changed)
+		xdpi_async_query_screens(a);
+	else
+		xdpi_async_expect(a, XDPI_ASYNC_IDLE, 0);
+}
+
+/* Advance by one state, if possible. Returns True if it did */
+static Bool xdpi_async_step(struct xdpi_async *a)
+{
+	switch (a->state) {
+	case XDPI_ASYNC_IDLE:
+		if (!a->changed)
+			return False;
+		xdpi_async_query_screens(a);
+		return True;
+	case XDPI_ASYNC_FAILED:
+		return False;
+	default:
+		break;
+	}
+
+	if (!xdpi_async_poll(a))
+		return False;
+
+	switch (a->state) {
+	case XDPI_ASYNC_EXTENSION:
+		xdpi_async_setup(a);
+		break;
+	case XDPI_ASYNC_SCREENS:
+		xdpi_async_query_outputs(a);
+		break;
+	case XDPI_ASYNC_OUTPUTS:
+		xdpi_async_finish(a);
+		break;
+	default:
+		break;
+	}
+	return True;
+}
+
+/* Connect to the given display (NULL for $DISPLAY) and start querying.
+ * Returns NULL if the connection fails
+ */
+struct xdpi_async *xdpi_async_new(const char *display, unsigned flags,
+	xdpi_async_callback callback, void *data)
+{
+	xcb_connection_t *conn = xcb_connect(display, NULL);
+	if (xcb_connection_has_error(conn)) {
+		xcb_disconnect(conn);
+		return NULL;
+	}
+
+	struct xdpi_async *a = calloc(1, sizeof(*a));
+	const xcb_setup_t *setup = xcb_get_setup(conn);
+	const int num_screens = xcb_setup_roots_length(setup);
+	xcb_screen_t *screens = calloc(num_screens, sizeof(*screens));
+	if (!a || !screens)
+		error("out of memory for asynchronous DPI tracking");
+
+	xcb_screen_iterator_t iter = xcb_setup_roots_iterator(setup);
+	for (int i = 0; iter.rem; ++i, xcb_screen_next(&iter))
+		screens[i] = *iter.data;
+
+	a->conn = conn;
+	a->flags = flags;
+	a->callback = callback;
+	a->data = data;
+	a->num_screens = num_screens;
+	a->screens = screens;
+
+	/* xcb looks the extension up on the first RANDR request, waiting for
+	 * the reply: prefetch it, and wait for the reply to our own query,
+	 * that comes after it */
+	xcb_prefetch_extension_data(conn, &xcb_randr_id);
+	struct xdpi_async_request *req = xdpi_async_expect(a, XDPI_ASYNC_EXTENSION, 1);
+	req->sequence = xcb_query_extension(conn, strlen(xcb_randr_id.name), xcb_randr_id.name).sequence;
+	xcb_flush(conn);
+
+	return a;
+}
+
+/* The fd to wait on for readability */
+int xdpi_async_fd(const struct xdpi_async *a)
+{
+	return xcb_get_file_descriptor(a->conn);
+}
+
+/* Process whatever arrived, without waiting for replies (but see above
+ * about sending the requests).
+ * Returns -1 if the connection failed, or RANDR is missing
+ */
+int xdpi_async_dispatch(struct xdpi_async *a)
+{
+	/* Replies can bring events along, and the other way around: neither
+	 * would make the fd readable again */
+	xdpi_async_events(a);
+	while (!xcb_connection_has_error(a->conn) &&
+		(xdpi_async_step(a) || xdpi_async_events(a)))
+		;
+	xcb_flush(a->conn);
+	return xcb_connection_has_error(a->conn) || a->state == XDPI_ASYNC_FAILED ? -1 : 0;
+}
+
+/* The last complete snapshot, if any */
+const struct xdpi_snapshot *xdpi_async_snapshot(const struct xdpi_async *a)
+{
+	return a->snap.num_screens ? &a->snap : NULL;
+}
+
+void xdpi_async_free(struct xdpi_async *a)
+{
+	if (!a)
+		return;
+	xdpi_async_free_requests(a->req, a->nreq);
+	xdpi_async_free_requests(a->screen_req, 3*a->num_screens + 1);
+	xdpi_snapshot_free(&a->snap);
+	free(a->screens);
+	xcb_disconnect(a->conn);
+	free(a);
+}
+#endif
+
+/*
+ * Monitor spatial index
+ */
+
+/* To find the monitor (or output) under a point or window, the root window
+ * is split into vertical slabs at every left/right edge of the rectangles.
+ * Within each slab, no rectangle starts or ends, so each slab is further split
+ * into segments at every top/bottom edge of the rectangles crossing it, and each
+ * segment is assigned to (the first of) the rectangles covering it.
+ * A point lookup is then a binary search for the slab, followed by a binary
+ * search for the segment.
+ */
+struct dpi_slab
+{
+	int nseg;
+	/* nseg+1 segment boundaries, and the record covering each segment
+	 * (-1 for gaps) */
+	int *y;
+	int *owner;
+};
+
+struct dpi_index
+{
+	const struct named_dpi *recs;
+	int nrecs;
+	int nslab;
+	/* nslab+1 slab boundaries */
+	int *x;
+	struct dpi_slab *slabs;
+	/* Scratch space for the rectangle lookup: overlap area per record,
+	 * and the records with a non-zero area */
+	long long *area;
+	int *touched;
+};
+
+static int cmp_int(const void *a, const void *b)
+{
+	const int x = *(const int*)a, y = *(const int*)b;
+	return (x > y) - (x < y);
+}
+
+/* Sort and deduplicate the n values, returning the number of unique values */
+static int sort_unique(int *v, int n)
+{
+	if (!n)
+		return 0;
+	qsort(v, n, sizeof(*v), cmp_int);
+	int u = 1;
+	for (int k = 1; k < n; ++k)
+		if (v[k] != v[u-1])
+			v[u++] = v[k];
+	return u;
+}
+
+/* Index of the last boundary not greater than val, or -1 */
+static int find_boundary(const int *bound, int n, int val)
+{
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = lo + (hi - lo)/2;
+		if (bound[mid] <= val)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+static inline Bool rect_valid(const struct named_dpi *rec)
+{
+	return rec->dpi > 0 && rec->width > 0 && rec->height > 0;
+}
+
+/* Build the index for the given records, skipping those without a valid
+ * DPI or geometry. The records must outlive the index.
+ */
+struct dpi_index *dpi_index_build(const struct named_dpi *recs, int nrecs)
+{
+	struct dpi_index *idx = calloc(1, sizeof(*idx));
+	int *xs = calloc(2*nrecs + 1, sizeof(*xs));
+	if (!idx || !xs) error("out of memory for the monitor index");
+
+	idx->recs = recs;
+	idx->nrecs = nrecs;
+	idx->area = calloc(nrecs + 1, sizeof(*idx->area));
+	idx->touched = calloc(nrecs + 1, sizeof(*idx->touched));
+	if (!idx->area || !idx->touched) error("out of memory for the monitor index");
+
+	int n = 0;
+	for (int r = 0; r < nrecs; ++r) {
+		if (!rect_valid(recs + r))
+			continue;
+		xs[n++] = recs[r].x;
+		xs[n++] = recs[r].x + recs[r].width;
+	}
+	n = sort_unique(xs, n);
+	idx->x = xs;
+	idx->nslab = n > 0 ? n - 1 : 0;
+	idx->slabs = calloc(idx->nslab + 1, sizeof(*idx->slabs));
+	if (!idx->slabs) error("out of memory for the monitor index");
+
+	/* Collect the rectangles crossing each slab: count them first, then
+	 * fill a single array with per-slab offsets */
+	int *start = calloc(idx->nslab + 2, sizeof(*start));
+	if (!start) error("out of memory for the monitor index");
+	for (int r = 0; r < nrecs; ++r) {
+		if (!rect_valid(recs + r))
+			continue;
+		int first = find_boundary(xs, n, recs[r].x);
+		int last = find_boundary(xs, n, recs[r].x + recs[r].width);
+		for (int s = first; s < last; ++s)
+			++start[s + 1];
+	}
+	for (int s = 0; s < idx->nslab; ++s)
+		start[s + 1] += start[s];
+
+	int *crossing = calloc(start[idx->nslab] + 1, sizeof(*crossing));
+	int *fill = calloc(idx->nslab + 1, sizeof(*fill));
+	if (!crossing || !fill) error("out of memory for the monitor index");
+	for (int r = 0; r < nrecs; ++r) {
+		if (!rect_valid(recs + r))
+			continue;
+		int first = find_boundary(xs, n, recs[r].x);
+		int last = find_boundary(xs, n, recs[r].x + recs[r].width);
+		for (int s = first; s < last; ++s)
+			crossing[start[s] + fill[s]++] = r;
+	}
+
+	for (int s = 0; s < idx->nslab; ++s) {
+		struct dpi_slab *slab = idx->slabs + s;
+		const int *rs = crossing + start[s];
+		const int k = start[s + 1] - start[s];
+
+		slab->y = calloc(2*k + 1, sizeof(*slab->y));
+		slab->owner = calloc(2*k + 1, sizeof(*slab->owner));
+		if (!slab->y || !slab->owner) error("out of memory for the monitor index");
+
+		for (int j = 0; j < k; ++j) {
+			slab->y[2*j] = recs[rs[j]].y;
+			slab->y[2*j+1] = recs[rs[j]].y + recs[rs[j]].height;
+		}
+		const int ny = sort_unique(slab->y, 2*k);
+		slab->nseg = ny > 0 ? ny - 1 : 0;
+
+		for (int g = 0; g < slab->nseg; ++g)
+			slab->owner[g] = -1;
+		/* The records are in order, so each segment is assigned to the
+		 * first record covering it */
+		for (int j = k - 1; j >= 0; --j) {
+			const struct named_dpi *rec = recs + rs[j];
+			int first = find_boundary(slab->y, ny, rec->y);
+			int last = find_boundary(slab->y, ny, rec->y + rec->height);
+			for (int g = first; g < last; ++g)
+				slab->owner[g] = rs[j];
+		}
+	}
+
+	free(fill);
+	free(crossing);
+	free(start);
+	return idx;
+}
+
+void dpi_index_free(struct dpi_index *idx)
+{
+	if (!idx)
+		return;
+	for (int s = 0; s < idx->nslab; ++s) {
+		free(idx->slabs[s].y);
+		free(idx->slabs[s].owner);
+	}
+	free(idx->slabs);
+	free(idx->x);
+	free(idx->area);
+	free(idx->touched);
+	free(idx);
+}
+
+/* Index of the record under the given point, or -1 if there is none,
+ * in O(log n) for n records
+ */
+int dpi_index_at(const struct dpi_index *idx, int x, int y)
+{
+	int s = find_boundary(idx->x, idx->nslab + 1, x);
+	if (s < 0 || s >= idx->nslab)
+		return -1;
+
+	const struct dpi_slab *slab = idx->slabs + s;
+	int g = find_boundary(slab->y, slab->nseg + 1, y);
+	if (g < 0 || g >= slab->nseg)
+		return -1;
+	return slab->owner[g];
+}
+
+/* Index of the record with the largest overlap with the given rectangle,
+ * or -1 if there is none. Ties go to the first record.
+ * This is not O(log n): finding the first slab and segment takes logarithmic
+ * time, but every segment the rectangle overlaps is then visited, so it is
+ * O(log n) only for rectangles within a single cell (e.g. a window inside
+ * one monitor), and large rectangles over many small monitors cost up to
+ * O(slabs*segments).
+ */
+int dpi_index_rect(struct dpi_index *idx, int x, int y, int width, int height)
+{
+	const int x1 = x + width, y1 = y + height;
+	int best = -1;
+	int ntouched = 0;
+
+	if (width <= 0 || height <= 0)
+		return dpi_index_at(idx, x, y);
+
+	int s = find_boundary(idx->x, idx->nslab + 1, x);
+	if (s < 0)
+		s = 0;
+	for (; s < idx->nslab && idx->x[s] < x1; ++s) {
+		const int sx0 = idx->x[s] > x ? idx->x[s] : x;
+		const int sx1 = idx->x[s+1] < x1 ? idx->x[s+1] : x1;
+		if (sx1 <= sx0)
+			continue;
+
+		const struct dpi_slab *slab = idx->slabs + s;
+		int g = find_boundary(slab->y, slab->nseg + 1, y);
+		if (g < 0)
+			g = 0;
+		for (; g < slab->nseg && slab->y[g] < y1; ++g) {
+			const int owner = slab->owner[g];
+			const int gy0 = slab->y[g] > y ? slab->y[g] : y;
+			const int gy1 = slab->y[g+1] < y1 ? slab->y[g+1] : y1;
+			if (owner < 0 || gy1 <= gy0)
+				continue;
+			if (!idx->area[owner])
+				idx->touched[ntouched++] = owner;
+			idx->area[owner] += (long long)(sx1 - sx0)*(gy1 - gy0);
+			if (best < 0 || idx->area[owner] > idx->area[best] ||
+				(idx->area[owner] == idx->area[best] && owner < best))
+				best = owner;
+		}
+	}
+
+	/* Clear the scratch space for the next lookup */
+	while (ntouched > 0)
+		idx->area[idx->touched[--ntouched]] = 0;
+
+	return best;
+}
+
+/* Look up the DPI at the selected point, or under the selected window,
+ * and show the scaling factors of the monitor (or output) found there
+ */
+static int lookup_dpi(void)
+{
+	Display *disp = XOpenDisplay(getenv("DISPLAY"));
+	if (!disp) {
+		fputs("Could not open X display\n", stderr);
+		return 1;
+	}
+
+	int scr = sel.screen < 0 ? DefaultScreen(disp) : sel.screen;
+	int x = sel.x, y = sel.y;
+	unsigned int width = 0, height = 0;
+
+	if (!sel.at) {
+		Window root, child;
+		int wx, wy;
+		unsigned int border, depth;
+		if (!XGetGeometry(disp, sel.window, &root, &wx, &wy, &width, &height, &border, &depth)) {
+			fprintf(stderr, "could not get the geometry of window 0x%lx\n", sel.window);
+			XCloseDisplay(disp);
+			return 1;
+		}
+		XTranslateCoordinates(disp, sel.window, root, 0, 0, &x, &y, &child);
+		for (scr = 0; scr < ScreenCount(disp); ++scr)
+			if (RootWindow(disp, scr) == root)
+				break;
+	}
+
+	int num_screens = do_xlib_dpi(NULL, disp);
+	int ret = 1;
+
+	if (scr < num_screens) {
+		/* Monitors are preferred, since they can span multiple outputs */
+		const Bool use_monitors = nmon[scr] > 0;
+		const struct named_dpi *list = use_monitors ? monitor_dpi[scr] : output_dpi[scr];
+		const int count = use_monitors ? nmon[scr] : noutput[scr];
+
+		struct dpi_index *idx = dpi_index_build(list, count);
+		int found = dpi_index_rect(idx, x, y, width, height);
+		dpi_index_free(idx);
+
+		if (found >= 0) {
+			printf("Screen %d:\n", scr);
+			printf("\t%s:\n", use_monitors ? "monitors" : "outputs");
+			print_scaling_record(stdout, list + found, reference_dpi[scr]/96.0f,
+				primary_dpi(list, count));
+			ret = 0;
+		} else {
+			fprintf(stderr, "no monitor found at %d,%d\n", x, y);
+		}
+	}
+
+	free_dpi_info(num_screens);
+	XCloseDisplay(disp);
+	return ret;
+}
+
+/*
+ * Live DPI propagation
+ */
+
+/* In live mode, we listen for RANDR changes, and publish the DPI matching the
+ * (rounded) native scaling of the primary monitor or output of each screen,
+ * either as the XSETTINGS manager (Xft/DPI), or in the RESOURCE_MANAGER
+ * property (Xft.dpi), so that running applications can pick it up.
+ */
+enum propagate_mode {
+	PROPAGATE_NONE,
+	PROPAGATE_XSETTINGS,
+	PROPAGATE_XRM
+};
+
+enum propagate_mode propagate = PROPAGATE_NONE;
+
+/* Milliseconds without RANDR events to wait for before recomputing the DPI,
+ * so that the burst of events produced by a single (un)docking only causes
+ * one update
+ */
+long propagate_debounce = 500;
+
+static int propagated_dpi(int i)
+{
+	int dpi = 0;
+	if (nmon[i])
+		dpi = primary_dpi(monitor_dpi[i], nmon[i]);
+	if (dpi <= 0 && noutput[i])
+		dpi = primary_dpi(output_dpi[i], noutput[i]);
+	if (dpi <= 0)
+		dpi = reference_dpi[i];
+	return 96*calc_scaling(dpi/96.0f).round;
+}
+
+struct xsettings_manager
+{
+	Window win;
+	Atom selection;
+	Bool owned;
+	uint32_t serial;
+	/* The settings we publish */
+	unsigned char *settings;
+	size_t settings_len;
+};
+
+/* Selections must be taken with an actual server timestamp rather than
+ * CurrentTime (ICCCM 2.1), which we get from the PropertyNotify produced by
+ * a zero-length append to a property of our own window
+ */
+static Time server_time(Display *disp, Window win)
+{
+	Atom prop = XInternAtom(disp, "_XDPI_TIMESTAMP", False);
+	XSelectInput(disp, win, PropertyChangeMask);
+	XChangeProperty(disp, win, prop, XA_INTEGER, 32, PropModeAppend, NULL, 0);
+
+	XEvent ev;
+	do {
+		XWindowEvent(disp, win, PropertyChangeMask, &ev);
+	} while (ev.xproperty.atom != prop);
+	XSelectInput(disp, win, NoEventMask);
+	return ev.xproperty.time;
+}
+
+/* Take over the _XSETTINGS_S# selection of the given screen,
+ * preserving the settings published by the previous manager, if any
+ */
+static Bool xsettings_acquire(Display *disp, int scr, Atom settings_atom,
+	struct xsettings_manager *mgr)
+{
+	Window root = RootWindow(disp, scr);
+	char name[64];
+	snprintf(name, sizeof(name), "_XSETTINGS_S%d", scr);
+	mgr->selection = XInternAtom(disp, name, False);
+
+	Window owner = XGetSelectionOwner(disp, mgr->selection);
+	if (owner != None) {
+		Atom prop_type;
+		int prop_format;
+		unsigned long nitems = 0;
+		unsigned long more_bytes = 0;
+		unsigned char *buffer = NULL;
+		int ret = XGetWindowProperty(disp, owner, settings_atom,
+			0, 4096, False, settings_atom,
+			&prop_type, &prop_format, &nitems, &more_bytes, &buffer);
+		if (ret == Success && prop_format == 8 && nitems >= 12 && !more_bytes) {
+			free(mgr->settings);
+			mgr->settings = malloc(nitems);
+			if (!mgr->settings) error("out of memory for XSETTINGS");
+			memcpy(mgr->settings, buffer, nitems);
+			mgr->settings_len = nitems;
+			mgr->serial = ((uint32_t*)buffer)[1] + 1;
+		}
+		if (buffer)
+			XFree(buffer);
+	}
+
+	if (!mgr->win)
+		mgr->win = XCreateSimpleWindow(disp, root, -1, -1, 1, 1, 0, 0, 0);
+
+	const Time timestamp = server_time(disp, mgr->win);
+	XSetSelectionOwner(disp, mgr->selection, mgr->win, timestamp);
+	if (XGetSelectionOwner(disp, mgr->selection) != mgr->win) {
+		fprintf(stderr, "XSETTINGS/Screen %d: could not become the settings manager\n", scr);
+		return False;
+	}
+
+	/* Announce ourselves as the new manager */
+	XClientMessageEvent ev = {
+		.type = ClientMessage,
+		.window = root,
+		.message_type = XInternAtom(disp, "MANAGER", False),
+		.format = 32,
+	};
+	ev.data.l[0] = timestamp;
+	ev.data.l[1] = mgr->selection;
+	ev.data.l[2] = mgr->win;
+	XSendEvent(disp, root, False, StructureNotifyMask, (XEvent*)&ev);
+
+	return mgr->owned = True;
+}
+
+/* Returns False if we are not (and could not become) the settings manager */
+static Bool xsettings_publish(Display *disp, int scr, int dpi,
+	struct xsettings_manager *mgr)
+{
+	Atom settings_atom = XInternAtom(disp, xsettings_settings, False);
+
+	if (!mgr->owned && !xsettings_acquire(disp, scr, settings_atom, mgr))
+		return False;
+
+	size_t len = 0;
+	unsigned char *settings = xsettings_set_xft_dpi(mgr->settings, mgr->settings_len,
+		mgr->serial++, dpi, &len);
+	free(mgr->settings);
+	mgr->settings = settings;
+	mgr->settings_len = len;
+
+	XChangeProperty(disp, mgr->win, settings_atom, settings_atom, 8,
+		PropModeReplace, settings, len);
+	return True;
+}
+
+/* The DPI currently published for the given screen (Xft/DPI by its settings
+ * manager, or Xft.dpi in the RESOURCE_MANAGER), or 0 if there is none,
+ * or it is not one we would publish
+ */
+static int current_dpi(Display *disp, int scr)
+{
+	if (propagate == PROPAGATE_XRM) {
+		/* Xlib loads the resources on connection */
+		const char *dpi = scr ? NULL : XGetDefault(disp, "Xft", "dpi");
+		const float xft_dpi = dpi ? strtof(dpi, NULL) : 0;
+		return xft_dpi == (int)xft_dpi ? (int)xft_dpi : 0;
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "_XSETTINGS_S%d", scr);
+	Atom selection = XInternAtom(disp, name, True);
+	Atom settings_atom = XInternAtom(disp, xsettings_settings, True);
+	Window owner = (selection != None && settings_atom != None) ?
+		XGetSelectionOwner(disp, selection) : None;
+	if (owner == None)
+		return 0;
+
+	Atom prop_type;
+	int prop_format;
+	unsigned long nitems = 0;
+	unsigned long more_bytes = 0;
+	unsigned char *buffer = NULL;
+	int32_t xft_dpi = 0;
+	int ret = XGetWindowProperty(disp, owner, settings_atom,
+		0, 4096, False, settings_atom,
+		&prop_type, &prop_format, &nitems, &more_bytes, &buffer);
+	if (ret == Success && prop_format == 8 && !more_bytes &&
+		xsettings_parse_xft_dpi(buffer, nitems, &xft_dpi) != XSETTINGS_FOUND)
+		xft_dpi = 0;
+	if (buffer)
+		XFree(buffer);
+	return xft_dpi % 1024 ? 0 : xft_dpi/1024;
+}
+
+/* Replace (or add) Xft.dpi in the RESOURCE_MANAGER property */
+static void xrm_publish(Display *disp, int dpi)
+{
+	Window root = RootWindow(disp, 0);
+
+	/* Prevent concurrent changes to the resources while we rewrite them */
+	XGrabServer(disp);
+
+	Atom prop_type;
+	int prop_format;
+	unsigned long nitems = 0;
+	unsigned long more_bytes = 0;
+	unsigned char *buffer = NULL;
+	XGetWindowProperty(disp, root, XA_RESOURCE_MANAGER,
+		0, 0x1000000, False, XA_STRING,
+		&prop_type, &prop_format, &nitems, &more_bytes, &buffer);
+
+	char xft_dpi[32];
+	int xft_dpi_len = snprintf(xft_dpi, sizeof(xft_dpi), "Xft.dpi:\t%d\n", dpi);
+
+	const char *old = (buffer && prop_format == 8) ? (const char*)buffer : "";
+	const size_t old_len = (buffer && prop_format == 8) ? nitems : 0;
+	char *resources = malloc(old_len + xft_dpi_len + 2);
+	if (!resources) error("out of memory for X resources");
+
+	/* Copy all lines, except for the Xft.dpi ones */
+	size_t len = 0;
+	const char *line = old;
+	const char *end = old + old_len;
+	while (line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		const char *next = eol ? eol + 1 : end;
+		const char *key = line;
+		while (key < next && (*key == ' ' || *key == '\t'))
+			++key;
+		const Bool is_xft_dpi = (next - key > 7) && !memcmp(key, "Xft.dpi", 7) &&
+			(key[7] == ':' || key[7] == ' ' || key[7] == '\t');
+		if (!is_xft_dpi) {
+			memcpy(resources + len, line, next - line);
+			len += next - line;
+			if (!eol)
+				resources[len++] = '\n';
+		}
+		line = next;
+	}
+	memcpy(resources + len, xft_dpi, xft_dpi_len);
+	len += xft_dpi_len;
+
+	XChangeProperty(disp, root, XA_RESOURCE_MANAGER, XA_STRING, 8,
+		PropModeReplace, (unsigned char*)resources, len);
+
+	XUngrabServer(disp);
+	XFlush(disp);
+
+	free(resources);
+	if (buffer)
+		XFree(buffer);
+}
+
+static int propagate_dpi(void)
+{
+	Display *disp = XOpenDisplay(getenv("DISPLAY"));
+	if (!disp) {
+		fputs("Could not open X display\n", stderr);
+		return 1;
+	}
+
+	int rr_event_base = 0, rr_error_base = 0;
+	if (!XRRQueryExtension(disp, &rr_event_base, &rr_error_base)) {
+		fputs("RANDR is required to track DPI changes\n", stderr);
+		XCloseDisplay(disp);
+		return 1;
+	}
+
+	const int num_screens = ScreenCount(disp);
+	struct xsettings_manager *mgr = calloc(num_screens, sizeof(*mgr));
+	/* Last published DPI, per screen */
+	int *published = calloc(num_screens, sizeof(*published));
+	if (!mgr || !published)
+		error("out of memory for DPI propagation");
+
+	for (int i = 0; i < num_screens; ++i) {
+		XRRSelectInput(disp, RootWindow(disp, i),
+			RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+		/* Values that are already right are left alone, and so is
+		 * the settings manager that published them */
+		published[i] = current_dpi(disp, i);
+	}
+	randr_notified = True;
+
+	const int fd = ConnectionNumber(disp);
+	Bool changed = True;
+	double deadline = now_ms();
+
+	for (;;) {
+		while (XPending(disp)) {
+			XEvent ev;
+			XNextEvent(disp, &ev);
+			if (ev.type == rr_event_base + RRScreenChangeNotify ||
+				ev.type == rr_event_base + RRNotify) {
+				XRRUpdateConfiguration(&ev);
+				changed = True;
+				deadline = now_ms() + propagate_debounce;
+			} else if (ev.type == SelectionClear) {
+				for (int i = 0; i < num_screens; ++i) {
+					if (mgr[i].win != ev.xselectionclear.window)
+						continue;
+					fprintf(stderr, "XSETTINGS/Screen %d: another settings manager took over\n", i);
+					mgr[i].owned = False;
+				}
+			}
+		}
+
+		double wait = deadline - now_ms();
+		if (changed && wait <= 0) {
+			changed = False;
+			int count = do_xlib_dpi(NULL, disp);
+			journal_append(count);
+			for (int i = 0; i < count; ++i) {
+				const int dpi = propagated_dpi(i);
+				/* Only write when the value actually changes */
+				if (dpi == published[i])
+					continue;
+				/* There is only one RESOURCE_MANAGER, on the first screen */
+				if (propagate == PROPAGATE_XRM && i > 0)
+					continue;
+				printf("Screen %d: propagating DPI %d\n", i, dpi);
+				fflush(stdout);
+				/* When we could not become the settings manager, the
+				 * screen is tried again after the debounce interval */
+				if (propagate == PROPAGATE_XSETTINGS &&
+					!xsettings_publish(disp, i, dpi, mgr + i)) {
+					changed = True;
+					deadline = now_ms() + propagate_debounce;
+					continue;
+				}
+				if (propagate == PROPAGATE_XRM)
+					xrm_publish(disp, dpi);
+				published[i] = dpi;
+			}
+			free_dpi_info(count);
+			XFlush(disp);
+			continue;
+		}
+
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		struct timeval tv = {
+			.tv_sec = (long)wait/1000,
+			.tv_usec = ((long)wait % 1000)*1000
+		};
+		if (select(fd + 1, &fds, NULL, NULL, changed ? &tv : NULL) < 0) {
+			perror("select");
+			break;
+		}
+	}
+
+	for (int i = 0; i < num_screens; ++i)
+		free(mgr[i].settings);
+	free(mgr);
+	free(published);
+	XCloseDisplay(disp);
+	return 1;
+}
+
+/*
+ * Metrics export
+ */
+
+/* In metrics mode, we stay running with a single connection, and write a
+ * snapshot of the DPI information in the Prometheus text format to a file,
+ * for the node exporter textfile collector. Snapshots are taken every
+ * metrics_interval seconds, or only on changes (RANDR notifications and
+ * X resources updates) if no interval is set. The file is replaced
+ * atomically, and only when the DPI information changes: the query
+ * statistics that close the snapshot refer to the query that produced it.
+ */
+const char *metrics_file = NULL;
+long metrics_interval = 0;
+
+/* A text buffer that is reused across snapshots, and only grows */
+struct metrics_buffer
+{
+	char *data;
+	size_t len, size;
+};
+
+static void metrics_printf(struct metrics_buffer *buf, const char *fmt, ...)
+{
+	for (;;) {
+		va_list ap;
+		va_start(ap, fmt);
+		const int n = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			error("could not format metrics");
+		if (buf->len + n < buf->size) {
+			buf->len += n;
+			return;
+		}
+		size_t size = buf->size ? 2*buf->size : 4096;
+		while (size <= buf->len + n)
+			size *= 2;
+		char *data = realloc(buf->data, size);
+		if (!data) error("out of memory for metrics");
+		buf->data = data;
+		buf->size = size;
+	}
+}
+
+/* Label values must have backslashes, double quotes and newlines escaped */
+static void metrics_label(struct metrics_buffer *buf, const char *value)
+{
+	for (const char *c = value; *c; ++c) {
+		if (*c == '\\' || *c == '"')
+			metrics_printf(buf, "\\%c", *c);
+		else if (*c == '\n')
+			metrics_printf(buf, "\\n");
+		else
+			metrics_printf(buf, "%c", *c);
+	}
+}
+
+static void metrics_family(struct metrics_buffer *buf, const char *name, const char *help)
+{
+	metrics_printf(buf, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+}
+
+/* Start a sample of the metric for the given output or monitor */
+static void metrics_sample(struct metrics_buffer *buf, const char *metric,
+	const char *kind, int screen, const struct named_dpi *rec)
+{
+	metrics_printf(buf, "xdpi_%s_%s{screen=\"%d\",%s=\"", kind, metric, screen, kind);
+	metrics_label(buf, rec->name);
+	metrics_printf(buf, "\"");
+}
+
+static void metrics_list(struct metrics_buffer *buf, int num_screens,
+	const char *kind, struct named_dpi **list, const int *count, Bool with_connection)
+{
+	char name[64];
+
+	if (with_connection) {
+		snprintf(name, sizeof(name), "xdpi_%s_connected", kind);
+		metrics_family(buf, name, "RANDR connection state (1 connected, 0 disconnected, -1 unknown)");
+		for (int i = 0; i < num_screens; ++i) for (int k = 0; k < count[i]; ++k) {
+			const int connection = list[i][k].connection;
+			metrics_sample(buf, "connected", kind, i, list[i] + k);
+			metrics_printf(buf, "} %d\n", connection == RR_Connected ? 1 :
+				connection == RR_Disconnected ? 0 : -1);
+		}
+	}
+
+	snprintf(name, sizeof(name), "xdpi_%s_dpi", kind);
+	metrics_family(buf, name, "DPI computed from the pixel and physical size");
+	for (int i = 0; i < num_screens; ++i) for (int k = 0; k < count[i]; ++k) {
+		if (list[i][k].dpi < 0) continue; /* not active */
+		metrics_sample(buf, "dpi", kind, i, list[i] + k);
+		metrics_printf(buf, "} %d\n", list[i][k].dpi);
+	}
+
+	snprintf(name, sizeof(name), "xdpi_%s_primary", kind);
+	metrics_family(buf, name, "1 for the primary one");
+	for (int i = 0; i < num_screens; ++i) for (int k = 0; k < count[i]; ++k) {
+		if (list[i][k].dpi < 0) continue;
+		metrics_sample(buf, "primary", kind, i, list[i] + k);
+		metrics_printf(buf, "} %d\n", list[i][k].primary ? 1 : 0);
+	}
+
+	snprintf(name, sizeof(name), "xdpi_%s_scale", kind);
+	metrics_family(buf, name, "native and prorated scaling factors, actual and rounded");
+	for (int i = 0; i < num_screens; ++i) {
+		const float reference = reference_dpi[i]/96.0f;
+		const int prim_dpi = primary_dpi(list[i], count[i]);
+		for (int k = 0; k < count[i]; ++k) {
+			const struct named_dpi *rec = list[i] + k;
+			if (rec->dpi < 0) continue;
+			const struct scaling_factor scale[2] = {
+				calc_scaling(rec->dpi/96.0f),
+				calc_scaling(prorated_scaling(reference, rec->dpi, prim_dpi))
+			};
+			static const char *scaling[2] = { "native", "prorated" };
+			for (int s = 0; s < 2; ++s) {
+				metrics_sample(buf, "scale", kind, i, rec);
+				metrics_printf(buf, ",scaling=\"%s\",value=\"actual\"} %g\n",
+					scaling[s], scale[s].actual);
+				metrics_sample(buf, "scale", kind, i, rec);
+				metrics_printf(buf, ",scaling=\"%s\",value=\"round\"} %d\n",
+					scaling[s], scale[s].round);
 			}
 		}
-		free(output_dpi[i]);
 	}
-	free(monitor_dpi);
-	free(output_dpi);
-	free(reference_dpi);
+}
+
+/* Format the DPI information collected for num_screens */
+static void metrics_format(struct metrics_buffer *buf, int num_screens)
+{
+	metrics_family(buf, "xdpi_screen_reference_dpi", "core DPI of the screen, or Xft.dpi if set");
+	for (int i = 0; i < num_screens; ++i)
+		metrics_printf(buf, "xdpi_screen_reference_dpi{screen=\"%d\"} %g\n", i, reference_dpi[i]);
+
+	metrics_family(buf, "xdpi_screen_reference_scale", "reference scaling factor of the screen");
+	for (int i = 0; i < num_screens; ++i)
+		metrics_printf(buf, "xdpi_screen_reference_scale{screen=\"%d\"} %g\n",
+			i, calc_scaling(reference_dpi[i]/96.0f).actual);
+
+	metrics_list(buf, num_screens, "output", output_dpi, noutput, True);
+	metrics_list(buf, num_screens, "monitor", monitor_dpi, nmon, False);
+}
+
+/* Replace the metrics file with the buffer contents */
+static Bool metrics_write(const char *tmp_file, const struct metrics_buffer *buf)
+{
+	int fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(tmp_file);
+		return False;
+	}
+	size_t done = 0;
+	while (done < buf->len) {
+		ssize_t n = write(fd, buf->data + done, buf->len - done);
+		if (n < 0) {
+			perror(tmp_file);
+			close(fd);
+			unlink(tmp_file);
+			return False;
+		}
+		done += n;
+	}
+	close(fd);
+	if (rename(tmp_file, metrics_file)) {
+		perror(metrics_file);
+		unlink(tmp_file);
+		return False;
+	}
+	return True;
+}
+
+/* Xlib only loads the resource database on connection, so it must be
+ * reloaded by hand when the RESOURCE_MANAGER property changes.
+ * XrmSetDatabase destroys the database XGetDefault loaded by itself,
+ * but not the ones we set, so we destroy those.
+ */
+static void xrm_reload(Display *disp)
+{
+	static XrmDatabase loaded = NULL;
+
+	Atom prop_type;
+	int prop_format;
+	unsigned long nitems = 0;
+	unsigned long more_bytes = 0;
+	unsigned char *buffer = NULL;
+	XGetWindowProperty(disp, RootWindow(disp, 0), XA_RESOURCE_MANAGER,
+		0, 0x1000000, False, XA_STRING,
+		&prop_type, &prop_format, &nitems, &more_bytes, &buffer);
+
+	XrmDatabase db = XrmGetStringDatabase(
+		(buffer && prop_format == 8) ? (const char*)buffer : "");
+	XrmSetDatabase(disp, db);
+	if (loaded)
+		XrmDestroyDatabase(loaded);
+	loaded = db;
+	if (buffer)
+		XFree(buffer);
+}
+
+/* Whether the RANDR configuration of every screen is still the one of
+ * the last snapshot. XRRTimes answers from the screen information cached
+ * by Xlib, which is only fetched again (with a round trip) after a RANDR
+ * screen change notification invalidated it.
+ */
+static Bool metrics_config_unchanged(Display *disp, int num_screens)
+{
+	for (int i = 0; i < num_screens; ++i) {
+		Time config = 0;
+		XRRTimes(disp, i, &config);
+		if (config != config_time[i])
+			return False;
+	}
+	return True;
+}
+
+static int export_metrics(void)
+{
+	Display *disp = XOpenDisplay(getenv("DISPLAY"));
+	if (!disp) {
+		fputs("Could not open X display\n", stderr);
+		return 1;
+	}
+
+	int rr_event_base = 0, rr_error_base = 0;
+	const Bool has_randr = XRRQueryExtension(disp, &rr_event_base, &rr_error_base);
+	if (!has_randr && !metrics_interval) {
+		fputs("RANDR is required to export metrics on changes only\n", stderr);
+		XCloseDisplay(disp);
+		return 1;
+	}
+
+	const int num_screens = ScreenCount(disp);
+	if (has_randr) {
+		for (int i = 0; i < num_screens; ++i)
+			XRRSelectInput(disp, RootWindow(disp, i),
+				RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+		randr_notified = True;
+	}
+	XSelectInput(disp, RootWindow(disp, 0), PropertyChangeMask);
+
+	char *tmp_file = malloc(strlen(metrics_file) + 5);
+	if (!tmp_file) error("out of memory for metrics");
+	sprintf(tmp_file, "%s.tmp", metrics_file);
+
+	/* The current and the last written snapshot, with the length of their
+	 * DPI information
+	 */
+	struct metrics_buffer buf[2] = { { .len = 0 }, { .len = 0 } };
+	size_t dpi_len[2] = { 0, 0 };
+	int cur = 0;
+	Bool written = False;
+	/* Screens of the last snapshot */
+	int count = 0;
+
+	const int fd = ConnectionNumber(disp);
+	Bool changed = True;
+	double deadline = now_ms();
+	double next_snapshot = deadline;
+
+	for (;;) {
+		while (XPending(disp)) {
+			XEvent ev;
+			XNextEvent(disp, &ev);
+			if (has_randr && (ev.type == rr_event_base + RRScreenChangeNotify ||
+				ev.type == rr_event_base + RRNotify)) {
+				XRRUpdateConfiguration(&ev);
+			} else if (ev.type == PropertyNotify &&
+				ev.xproperty.atom == XA_RESOURCE_MANAGER) {
+				xrm_reload(disp);
+			} else {
+				continue;
+			}
+			changed = True;
+			deadline = now_ms() + propagate_debounce;
+		}
+
+		const double now = now_ms();
+		const Bool settled = changed && now >= deadline;
+		if (settled || (metrics_interval && now >= next_snapshot)) {
+			next_snapshot = now + metrics_interval*1000.0;
+
+			/* Between changes, the interval only costs a look at the
+			 * cached RANDR configuration timestamps */
+			if (!settled && written && has_randr && metrics_config_unchanged(disp, count))
+				continue;
+			changed = False;
+
+			/* The DPI information is kept between snapshots, so that
+			 * do_xlib_dpi reuses it rather than allocating it afresh
+			 * (the Xlib replies it is built from are still allocated).
+			 * The requests sent are counted rather than the round
+			 * trips, as some requests are batched or have no reply.
+			 */
+			const unsigned long first_request = NextRequest(disp);
+			const double start = now_ms();
+			count = do_xlib_dpi(NULL, disp);
+			const double elapsed = now_ms() - start;
+			const unsigned long requests = NextRequest(disp) - first_request;
+
+			struct metrics_buffer *b = buf + cur;
+			b->len = 0;
+			metrics_format(b, count);
+			dpi_len[cur] = b->len;
+
+			/* Only write when the DPI information actually changes */
+			const struct metrics_buffer *last = buf + !cur;
+			const Bool same = written && dpi_len[cur] == dpi_len[!cur] &&
+				!memcmp(b->data, last->data, dpi_len[cur]);
+			if (same)
+				continue;
+			journal_append(count);
+
+			metrics_family(b, "xdpi_query_seconds", "duration of the query");
+			metrics_printf(b, "xdpi_query_seconds %g\n", elapsed/1000);
+			metrics_family(b, "xdpi_query_requests", "requests sent to the X server by the query");
+			metrics_printf(b, "xdpi_query_requests %lu\n", requests);
+
+			if (metrics_write(tmp_file, b)) {
+				written = True;
+				cur = !cur;
+			}
+			continue;
+		}
+
+		double wait = -1;
+		if (changed)
+			wait = deadline - now;
+		if (metrics_interval && (wait < 0 || next_snapshot - now < wait))
+			wait = next_snapshot - now;
+
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		struct timeval tv = {
+			.tv_sec = (long)wait/1000,
+			.tv_usec = ((long)wait % 1000)*1000
+		};
+		if (select(fd + 1, &fds, NULL, NULL, wait >= 0 ? &tv : NULL) < 0) {
+			perror("select");
+			break;
+		}
+	}
+
+	free_dpi_info(count);
+	free(buf[0].data);
+	free(buf[1].data);
+	free(tmp_file);
+	XCloseDisplay(disp);
+	return 1;
+}
+
+/*
+ * Window tracking
+ */
+
+/* In tracking mode, we stay running, and follow the ConfigureNotify events of
+ * the given windows. Each new geometry is mapped to the monitor (or output)
+ * the window mostly overlaps, with the spatial index of its screen, and a line
+ * is only printed when the effective DPI or scaling factors of the window
+ * change: moves within a monitor, or to a monitor with the same DPI, are
+ * silent. The indices are rebuilt, and all windows checked again, on RANDR
+ * and X resources changes (after the debounce interval).
+ *
+ * ConfigureNotify coordinates are relative to the parent: for windows
+ * reparented by the window manager, the events of their frame (the ancestor
+ * that is a child of the root window) are followed too, and carry the root
+ * coordinates. The offset of the window in its frame is only queried again
+ * when it is reparented, so that no event costs a round trip.
+ */
+unsigned long *tracked_ids = NULL;
+int ntracked = 0;
+
+struct tracked_window
+{
+	Window id;
+	int screen;
+	Bool destroyed;
+	int x, y, width, height;
+	/* Top-level ancestor (None if not reparented), and offsets in it of
+	 * the window and of its parent, in the frame coordinates */
+	Window frame;
+	int dx, dy;
+	int parent_dx, parent_dy;
+	/* Last reported DPI (0 if outside all monitors, -1 before the first
+	 * report) and prorated scaling */
+	int dpi;
+	float prorated;
+};
+
+struct tracked_screen
+{
+	struct dpi_index *idx;
+	const struct named_dpi *list;
+	Bool monitors;
+	float reference;
+	int prim_dpi;
+};
+
+/* Windows may be destroyed at any time, making requests about them fail */
+static int track_x_error(Display *disp, XErrorEvent *ev)
+{
+	(void)disp;
+	(void)ev;
+	return 0;
+}
+
+/* Query the position of the window in root coordinates. Returns False if
+ * it does not exist anymore
+ */
+static Bool track_translate(Display *disp, struct tracked_window *w)
+{
+	Window child;
+	return XTranslateCoordinates(disp, w->id, RootWindow(disp, w->screen),
+		0, 0, &w->x, &w->y, &child);
+}
+
+/* Find the frame of the window, select its structure events, and query the
+ * offsets of the window in it. This takes a few round trips, so it is only
+ * done at startup and on reparents. Returns False if the window does not
+ * exist anymore
+ */
+static Bool track_frame(Display *disp, struct tracked_window *w)
+{
+	const Window root = RootWindow(disp, w->screen);
+	Window frame = w->id, parent = None;
+	for (;;) {
+		Window r, up, *children = NULL;
+		unsigned int nchildren;
+		if (!XQueryTree(disp, frame, &r, &up, &children, &nchildren))
+			return False;
+		if (children)
+			XFree(children);
+		if (parent == None)
+			parent = up;
+		if (up == root || up == None)
+			break;
+		frame = up;
+	}
+
+	if (w->frame && w->frame != frame)
+		XSelectInput(disp, w->frame, NoEventMask);
+	if (frame == w->id) {
+		w->frame = None;
+		return track_translate(disp, w);
+	}
+	/* Select the events first, so that no move is missed after the
+	 * queries below */
+	if (frame != w->frame)
+		XSelectInput(disp, frame, StructureNotifyMask);
+	w->frame = frame;
+
+	Window child;
+	int fx, fy;
+	if (!XTranslateCoordinates(disp, w->id, frame, 0, 0, &w->dx, &w->dy, &child) ||
+		!XTranslateCoordinates(disp, parent, frame, 0, 0,
+			&w->parent_dx, &w->parent_dy, &child) ||
+		!XTranslateCoordinates(disp, frame, root, 0, 0, &fx, &fy, &child))
+		return False;
+	w->x = fx + w->dx;
+	w->y = fy + w->dy;
+	return True;
+}
+
+/* Rebuild the frame lookup after reparents */
+static void track_index_frames(struct xid_index *by_frame,
+	const struct tracked_window *win, int nwin)
+{
+	xid_index_free(by_frame);
+	xid_index_init(by_frame, nwin);
+	for (int k = 0; k < nwin; ++k)
+		if (!win[k].destroyed)
+			xid_index_add(by_frame, win[k].frame, k);
+}
+
+/* Rebuild the per-screen spatial indices from a new DPI pass, replacing
+ * the previous one (with count screens). Returns the new count
+ */
+static int track_rebuild(Display *disp, struct tracked_screen *ts, int count)
+{
+	const int num_screens = ScreenCount(disp);
+	for (int i = 0; i < num_screens; ++i)
+		dpi_index_free(ts[i].idx);
+	free_dpi_info(count);
+
+	count = do_xlib_dpi(NULL, disp);
+	journal_append(count);
+	for (int i = 0; i < num_screens; ++i) {
+		struct tracked_screen *s = ts + i;
+		memset(s, 0, sizeof(*s));
+		if (i >= count)
+			continue;
+		/* Monitors are preferred, since they can span multiple outputs */
+		s->monitors = nmon[i] > 0;
+		s->list = s->monitors ? monitor_dpi[i] : output_dpi[i];
+		const int n = s->monitors ? nmon[i] : noutput[i];
+		s->idx = dpi_index_build(s->list, n);
+		s->reference = reference_dpi[i]/96.0f;
+		s->prim_dpi = primary_dpi(s->list, n);
+	}
+	return count;
+}
+
+/* Find the monitor under the window, and report it if the DPI or
+ * scaling changed
+ */
+static void track_check(struct tracked_screen *ts, struct tracked_window *w)
+{
+	struct tracked_screen *s = ts + w->screen;
+	const int found = s->idx ?
+		dpi_index_rect(s->idx, w->x, w->y, w->width, w->height) : -1;
+	const struct named_dpi *rec = found >= 0 ? s->list + found : NULL;
+	const int dpi = rec ? rec->dpi : 0;
+	const float prorated = rec ? prorated_scaling(s->reference, dpi, s->prim_dpi) : 0;
+
+	if (dpi == w->dpi && prorated == w->prorated)
+		return;
+	w->dpi = dpi;
+	w->prorated = prorated;
+
+	if (!rec) {
+		printf("Window 0x%lx: outside of all monitors\n", w->id);
+	} else {
+		printf("Window 0x%lx: %s %s, %d DPI, native ", w->id,
+			s->monitors ? "monitor" : "output", rec->name, dpi);
+		print_scaling_factor(stdout, calc_scaling(dpi/96.0f));
+		fputs(", prorated ", stdout);
+		print_scaling_factor(stdout, calc_scaling(prorated));
+		fputc('\n', stdout);
+	}
+	fflush(stdout);
+}
+
+/* Update the window from one of its structure events, or of its frame.
+ * Returns True if its geometry may have changed
+ */
+static Bool track_event(Display *disp, struct tracked_window *w, const XEvent *ev)
+{
+	if (ev->xany.window == w->frame) {
+		/* The frame is a child of the root window, unless it was
+		 * reparented itself (e.g. into a virtual root) */
+		if (ev->type == ReparentNotify)
+			return track_frame(disp, w);
+		if (ev->type != ConfigureNotify || ev->xconfigure.send_event)
+			return False;
+		w->x = ev->xconfigure.x + ev->xconfigure.border_width + w->dx;
+		w->y = ev->xconfigure.y + ev->xconfigure.border_width + w->dy;
+		return True;
+	}
+
+	switch (ev->type) {
+	case ConfigureNotify:
+		w->width = ev->xconfigure.width;
+		w->height = ev->xconfigure.height;
+		if (!w->frame) {
+			w->x = ev->xconfigure.x;
+			w->y = ev->xconfigure.y;
+		} else if (!ev->xconfigure.send_event) {
+			/* Relative to the parent: the frame position is
+			 * unchanged, only the offset of the window in it.
+			 * Synthetic events (ICCCM 4.1.5) only repeat the
+			 * moves of the frame */
+			const int dx = w->parent_dx + ev->xconfigure.x + ev->xconfigure.border_width;
+			const int dy = w->parent_dy + ev->xconfigure.y + ev->xconfigure.border_width;
+			w->x += dx - w->dx;
+			w->y += dy - w->dy;
+			w->dx = dx;
+			w->dy = dy;
+		}
+		return True;
+	case ReparentNotify:
+		return track_frame(disp, w);
+	case DestroyNotify:
+		printf("Window 0x%lx: destroyed\n", w->id);
+		fflush(stdout);
+		w->destroyed = True;
+		return False;
+	default:
+		return False;
+	}
+}
+
+static int track_windows(void)
+{
+	Display *disp = XOpenDisplay(getenv("DISPLAY"));
+	if (!disp) {
+		fputs("Could not open X display\n", stderr);
+		return 1;
+	}
+
+	int rr_event_base = 0, rr_error_base = 0;
+	if (!XRRQueryExtension(disp, &rr_event_base, &rr_error_base)) {
+		fputs("RANDR is required to track windows\n", stderr);
+		XCloseDisplay(disp);
+		return 1;
+	}
+	XSetErrorHandler(track_x_error);
+
+	const int num_screens = ScreenCount(disp);
+	struct tracked_window *win = calloc(ntracked, sizeof(*win));
+	struct tracked_screen *ts = calloc(num_screens, sizeof(*ts));
+	if (!win || !ts)
+		error("out of memory for window tracking");
+
+	struct xid_index by_id;
+	xid_index_init(&by_id, ntracked);
+
+	int nwin = 0;
+	for (int k = 0; k < ntracked; ++k) {
+		if (xid_index_find(&by_id, tracked_ids[k]) >= 0)
+			continue;
+		struct tracked_window *w = win + nwin;
+		w->id = tracked_ids[k];
+		w->dpi = -1;
+
+		/* Select the events first, so that no change is missed between
+		 * the geometry query and the first ConfigureNotify */
+		XSelectInput(disp, w->id, StructureNotifyMask);
+
+		Window root;
+		unsigned int width, height, border, depth;
+		int wx, wy;
+		Bool found = XGetGeometry(disp, w->id, &root, &wx, &wy, &width, &height, &border, &depth);
+		if (found) {
+			for (w->screen = 0; w->screen < num_screens; ++w->screen)
+				if (RootWindow(disp, w->screen) == root)
+					break;
+			w->width = width;
+			w->height = height;
+			found = track_frame(disp, w);
+		}
+		if (!found) {
+			fprintf(stderr, "could not get the geometry of window 0x%lx\n", w->id);
+			XCloseDisplay(disp);
+			return 1;
+		}
+		xid_index_add(&by_id, w->id, nwin++);
+	}
+
+	struct xid_index by_frame = { NULL, NULL, 0 };
+	track_index_frames(&by_frame, win, nwin);
+
+	for (int i = 0; i < num_screens; ++i)
+		XRRSelectInput(disp, RootWindow(disp, i),
+			RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+	randr_notified = True;
+	XSelectInput(disp, RootWindow(disp, 0), PropertyChangeMask);
+
+	int count = track_rebuild(disp, ts, 0);
+	for (int k = 0; k < nwin; ++k)
+		track_check(ts, win + k);
+
+	const int fd = ConnectionNumber(disp);
+	Bool changed = False;
+	double deadline = 0;
+	int alive = nwin;
+
+	while (alive > 0) {
+		while (XPending(disp)) {
+			XEvent ev;
+			XNextEvent(disp, &ev);
+			if (ev.type == rr_event_base + RRScreenChangeNotify ||
+				ev.type == rr_event_base + RRNotify) {
+				XRRUpdateConfiguration(&ev);
+			} else if (ev.type == PropertyNotify &&
+				ev.xproperty.atom == XA_RESOURCE_MANAGER) {
+				xrm_reload(disp);
+			} else {
+				/* Structure events of the tracked windows and their
+				 * frames: a hash lookup, and an index lookup if the
+				 * geometry changed */
+				int k = xid_index_find(&by_id, ev.xany.window);
+				if (k < 0)
+					k = xid_index_find(&by_frame, ev.xany.window);
+				if (k < 0 || win[k].destroyed)
+					continue;
+				if (track_event(disp, win + k, &ev))
+					track_check(ts, win + k);
+				if (win[k].destroyed)
+					--alive;
+				if (ev.type == ReparentNotify || win[k].destroyed)
+					track_index_frames(&by_frame, win, nwin);
+				continue;
+			}
+			changed = True;
+			deadline = now_ms() + propagate_debounce;
+		}
+
+		double wait = deadline - now_ms();
+		if (changed && wait <= 0) {
+			changed = False;
+			count = track_rebuild(disp, ts, count);
+			for (int k = 0; k < nwin; ++k)
+				if (!win[k].destroyed)
+					track_check(ts, win + k);
+			continue;
+		}
+		if (alive <= 0)
+			break;
+
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		struct timeval tv = {
+			.tv_sec = (long)wait/1000,
+			.tv_usec = ((long)wait % 1000)*1000
+		};
+		if (select(fd + 1, &fds, NULL, NULL, changed ? &tv : NULL) < 0) {
+			perror("select");
+			break;
+		}
+	}
+
+	for (int i = 0; i < num_screens; ++i)
+		dpi_index_free(ts[i].idx);
+	free_dpi_info(count);
+	xid_index_free(&by_id);
+	xid_index_free(&by_frame);
+	free(ts);
+	free(win);
+	XCloseDisplay(disp);
+	return alive > 0;
 }
 
 static const char* dpi_related_vars[] = {
@@ -987,37 +4903,349 @@ static const char* dpi_related_vars[] = {
 	NULL
 };
 
-void print_relevant_env(void)
+void print_relevant_env(FILE *out)
 {
 	for (const char * const*var = dpi_related_vars; *var; ++var) {
 		char *v = getenv(*var);
 		if (v)
-			printf("%s=%s\n", *var, v);
+			fprintf(out, "%s=%s\n", *var, v);
+	}
+}
+
+
+static void usage(const char *progname)
+{
+	printf("Usage: %s [options]\n", progname);
+	puts("Options:");
+	puts("\t--screen N\tonly query screen N");
+	puts("\t--output NAME\tonly query (and show) the RANDR output NAME");
+	puts("\t--monitor NAME\tonly query (and show) the RANDR monitor NAME");
+	puts("\t--fast\t\tminimize round trips to the X server, for high-latency links;");
+	puts("\t\t\toutputs are only enumerated with --output (requires xcb)");
+	puts("\t--xinerama\talso query Xinerama in --fast mode");
+	puts("\t--at X,Y\tonly show the monitor (or output) at the given point");
+	puts("\t--window ID\tonly show the monitor (or output) the given window");
+	puts("\t\t\tmostly overlaps");
+	puts("\t--track ID\tstay running, and show the monitor (or output) the given");
+	puts("\t\t\twindow mostly overlaps whenever its DPI or scaling changes;");
+	puts("\t\t\tcan be repeated to track several windows");
+	puts("\t--sysfs\t\tdo not connect to the X server, but read the DRM connector");
+	puts("\t\t\tinformation from " DRM_SYSFS_ROOT);
+	puts("\t--sysfs-root DIR\tlike --sysfs, reading from DIR instead");
+	puts("\t--wayland\tdo not connect to the X server, but read the output");
+	puts("\t\t\tinformation from the Wayland compositor (requires wayland)");
+	puts("\t--propagate xsettings|xrm");
+	puts("\t\t\tstay running, and publish the DPI of the primary monitor");
+	puts("\t\t\twhenever it changes, as the XSETTINGS manager or in the");
+	puts("\t\t\tRESOURCE_MANAGER");
+	puts("\t--metrics FILE\tstay running, and write the DPI information to FILE");
+	puts("\t\t\tfor the Prometheus node exporter textfile collector");
+	puts("\t--interval SEC\ttake a metrics snapshot every SEC seconds, rather");
+	puts("\t\t\tthan only on RANDR and X resources changes");
+	puts("\t--journal FILE\tappend a record of every snapshot to FILE, a");
+	puts("\t\t\tfixed-size ring buffer keeping the most recent ones");
+	puts("\t--journal-size KB\tring buffer size of a new journal (default: 1024)");
+	puts("\t--journal-dump FILE\tdecode the records in FILE, oldest first");
+	puts("\t--debounce MS\twait for MS milliseconds without changes before");
+	puts("\t\t\tpropagating the DPI, exporting metrics or checking the");
+	puts("\t\t\ttracked windows again (default: 500)");
+	puts("\t-h, --help\tshow this help");
+}
+
+/* Fetch the argument of the option at argv[*i], advancing *i */
+static const char *option_arg(int argc, char *argv[], int *i)
+{
+	if (*i + 1 >= argc) {
+		fprintf(stderr, "option %s requires an argument\n", argv[*i]);
+		exit(2);
 	}
+	return argv[++*i];
 }
 
+static void parse_options(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; ++i) {
+		const char *opt = argv[i];
+		if (!strcmp(opt, "-h") || !strcmp(opt, "--help")) {
+			usage(argv[0]);
+			exit(0);
+		} else if (!strcmp(opt, "--screen")) {
+			char *end = NULL;
+			const char *arg = option_arg(argc, argv, &i);
+			sel.screen = strtol(arg, &end, 10);
+			if (!*arg || *end || sel.screen < 0) {
+				fprintf(stderr, "invalid screen number %s\n", arg);
+				exit(2);
+			}
+		} else if (!strcmp(opt, "--output")) {
+			sel.output = option_arg(argc, argv, &i);
+		} else if (!strcmp(opt, "--monitor")) {
+			sel.monitor = option_arg(argc, argv, &i);
+		} else if (!strcmp(opt, "--fast")) {
+#if WITH_XCB
+			fast_mode = True;
+#else
+			fputs("--fast requires xcb support\n", stderr);
+			exit(2);
+#endif
+		} else if (!strcmp(opt, "--xinerama")) {
+#if WITH_XCB
+			fast_xinerama = True;
+#else
+			fputs("--xinerama requires --fast, which requires xcb support\n", stderr);
+			exit(2);
+#endif
+		} else if (!strcmp(opt, "--at")) {
+			const char *arg = option_arg(argc, argv, &i);
+			char tail = 0;
+			if (sscanf(arg, "%d,%d%c", &sel.x, &sel.y, &tail) != 2) {
+				fprintf(stderr, "invalid point %s\n", arg);
+				exit(2);
+			}
+			sel.at = True;
+		} else if (!strcmp(opt, "--window")) {
+			char *end = NULL;
+			const char *arg = option_arg(argc, argv, &i);
+			sel.window = strtoul(arg, &end, 0);
+			if (!*arg || *end || !sel.window) {
+				fprintf(stderr, "invalid window %s\n", arg);
+				exit(2);
+			}
+		} else if (!strcmp(opt, "--track")) {
+			char *end = NULL;
+			const char *arg = option_arg(argc, argv, &i);
+			const unsigned long id = strtoul(arg, &end, 0);
+			if (!*arg || *end || !id) {
+				fprintf(stderr, "invalid window %s\n", arg);
+				exit(2);
+			}
+			tracked_ids = realloc(tracked_ids, (ntracked + 1)*sizeof(*tracked_ids));
+			if (!tracked_ids) error("out of memory for window tracking");
+			tracked_ids[ntracked++] = id;
+		} else if (!strcmp(opt, "--sysfs")) {
+			drm_sysfs_root = DRM_SYSFS_ROOT;
+		} else if (!strcmp(opt, "--sysfs-root")) {
+			drm_sysfs_root = option_arg(argc, argv, &i);
+		} else if (!strcmp(opt, "--wayland")) {
+#if WITH_WAYLAND
+			wayland_mode = True;
+#else
+			fputs("--wayland requires Wayland support\n", stderr);
+			exit(2);
+#endif
+		} else if (!strcmp(opt, "--propagate")) {
+			const char *arg = option_arg(argc, argv, &i);
+			if (!strcmp(arg, "xsettings")) {
+				propagate = PROPAGATE_XSETTINGS;
+			} else if (!strcmp(arg, "xrm")) {
+				propagate = PROPAGATE_XRM;
+			} else {
+				fprintf(stderr, "invalid propagation mode %s\n", arg);
+				exit(2);
+			}
+		} else if (!strcmp(opt, "--metrics")) {
+			metrics_file = option_arg(argc, argv, &i);
+		} else if (!strcmp(opt, "--interval")) {
+			char *end = NULL;
+			const char *arg = option_arg(argc, argv, &i);
+			metrics_interval = strtol(arg, &end, 10);
+			if (!*arg || *end || metrics_interval < 0) {
+				fprintf(stderr, "invalid metrics interval %s\n", arg);
+				exit(2);
+			}
+		} else if (!strcmp(opt, "--journal")) {
+			journal_file = option_arg(argc, argv, &i);
+		} else if (!strcmp(opt, "--journal-size")) {
+			char *end = NULL;
+			const char *arg = option_arg(argc, argv, &i);
+			journal_size = strtol(arg, &end, 10);
+			if (!*arg || *end || journal_size < 4 || journal_size > 1024*1024) {
+				fprintf(stderr, "invalid journal size %s\n", arg);
+				exit(2);
+			}
+			journal_size *= 1024;
+		} else if (!strcmp(opt, "--journal-dump")) {
+			journal_dump_file = option_arg(argc, argv, &i);
+		} else if (!strcmp(opt, "--debounce")) {
+			char *end = NULL;
+			const char *arg = option_arg(argc, argv, &i);
+			propagate_debounce = strtol(arg, &end, 10);
+			if (!*arg || *end || propagate_debounce < 0) {
+				fprintf(stderr, "invalid debounce interval %s\n", arg);
+				exit(2);
+			}
+		} else {
+			fprintf(stderr, "unknown option %s\n", opt);
+			usage(argv[0]);
+			exit(2);
+		}
+	}
+}
 
 int main(int argc, char *argv[])
 {
-	/* TODO support CLI options for help or output format selection */
-	(void)argc;
-	(void)argv;
+	/* TODO support CLI options for output format selection */
+	parse_options(argc, argv);
+
+	if (journal_dump_file)
+		return journal_dump(journal_dump_file);
+
+	if (journal_file) {
+		if (targeted_query() || sel.at || sel.window) {
+			fputs("--journal cannot be combined with --output, --monitor, --at or --window\n", stderr);
+			return 2;
+		}
+		journal = journal_map(journal_file, journal_size, True);
+		if (!journal)
+			return 1;
+#if WITH_XCB
+		/* The records hold the outputs and the configuration timestamp,
+		 * which only come with the screen resources */
+		fast_all_outputs = True;
+#endif
+	}
+
+#if WITH_XCB
+	if (fast_xinerama && !fast_mode) {
+		fputs("--xinerama requires --fast\n", stderr);
+		return 2;
+	}
+	if (fast_mode && drm_sysfs_root) {
+		fputs("--fast cannot be combined with --sysfs\n", stderr);
+		return 2;
+	}
+#endif
+
+#if WITH_WAYLAND
+	if (wayland_mode && (drm_sysfs_root || metrics_file ||
+			propagate != PROPAGATE_NONE || sel.at || sel.window || ntracked)) {
+		fputs("--wayland cannot be combined with --sysfs or X11-only options\n", stderr);
+		return 2;
+	}
+#endif
+
+	if (metrics_file) {
+		if (targeted_query() || sel.screen >= 0 || drm_sysfs_root ||
+			propagate != PROPAGATE_NONE || sel.at || sel.window || ntracked) {
+			fputs("--metrics cannot be combined with query selectors, --sysfs, --propagate or --track\n", stderr);
+			return 2;
+		}
+		return export_metrics();
+	}
+
+	if (propagate != PROPAGATE_NONE) {
+		if (targeted_query() || sel.screen >= 0 || drm_sysfs_root || ntracked) {
+			fputs("--propagate cannot be combined with query selectors, --sysfs or --track\n", stderr);
+			return 2;
+		}
+		return propagate_dpi();
+	}
 
-	puts("*** Resolution and dot pitch information exposed by X11 ***");
+	if (ntracked) {
+		if (targeted_query() || sel.screen >= 0 || drm_sysfs_root || sel.at || sel.window) {
+			fputs("--track cannot be combined with query selectors, --sysfs, --at or --window\n", stderr);
+			return 2;
+		}
+		return track_windows();
+	}
+
+	if (sel.at || sel.window) {
+		if (targeted_query() || drm_sysfs_root) {
+			fputs("--at and --window cannot be combined with --output, --monitor or --sysfs\n", stderr);
+			return 2;
+		}
+		return lookup_dpi();
+	}
+
+	/* The report is collected in memory and written in one go, rather than
+	 * in many small writes, which matters with thousands of outputs and monitors
+	 */
+	char *report_buf = NULL;
+	size_t report_len = 0;
+	FILE *out = open_memstream(&report_buf, &report_len);
+	if (!out)
+		out = stdout;
+
+	int num_screens = 0;
+
+	/* Targeted queries only show the selected records */
+	FILE *headers = targeted_query() ? NULL : out;
+
+	if (drm_sysfs_root) {
+		report(headers, "*** Resolution and dot pitch information exposed by DRM ***\n");
+
+		num_screens = drm_dpi(out);
+#if WITH_WAYLAND
+	} else if (wayland_mode) {
+		report(headers, "*** Resolution and dot pitch information exposed by Wayland ***\n");
+
+		num_screens = wayland_dpi(out);
+#endif
+#if WITH_XCB
+	} else if (fast_mode) {
+		report(headers, "*** Resolution and dot pitch information exposed by X11 ***\n");
+
+		num_screens = fast_xcb_dpi(out);
+#endif
+	} else {
+		report(headers, "*** Resolution and dot pitch information exposed by X11 ***\n");
+
+#if WITH_XCB
+		/* With a selector, the Xlib pass alone answers (and only
+		 * fetches the CRTCs of the selected outputs), rather than
+		 * setting up a second connection to show the same records again
+		 */
+		const Bool single_pass = targeted_query() || sel.screen >= 0;
+		struct xcb_pass pass = { .ret = 0 };
+		const Bool xcb_async = !single_pass && xcb_dpi_start(&pass);
+#endif
 
-	int num_screens = xlib_dpi();
+		num_screens = xlib_dpi(out);
 
 #if WITH_XCB
-	xcb_dpi();
+		if (xcb_async)
+			xcb_dpi_finish(&pass, out);
+		else if (!single_pass)
+			xcb_dpi(out);
 #endif
+	}
+
+	report(headers, "*** Auto-computed per-output scaling ***\n");
+
+	print_scaling_factors(out, num_screens);
+	journal_append(num_screens);
+	free_dpi_info(num_screens);
 
-	puts("*** Auto-computed per-output scaling ***");
+	/* For targeted queries, the environment is not of interest */
+	const Bool whole_report = !targeted_query() && sel.screen < num_screens;
+	if (whole_report) {
+		fputs("*** Environment variables ***\n", out);
 
-	print_scaling_factors(num_screens);
+		print_relevant_env(out);
 
-	puts("*** Environment variables ***");
+		fputs("*** Done ***\n", out);
+	}
+
+	if (out != stdout) {
+		fclose(out);
+		fwrite(report_buf, 1, report_len, stdout);
+		free(report_buf);
+	}
+	fflush(stdout);
+
+	/* The caller will want to know if nothing was found */
+	if (targeted_query()) {
+		if (!sel.found) {
+			fputs("no matching output or monitor found\n", stderr);
+			return 1;
+		}
+		return 0;
+	}
 
-	print_relevant_env();
+	if (sel.screen >= num_screens) {
+		fprintf(stderr, "no screen %d found\n", sel.screen);
+		return 1;
+	}
 
-	puts("*** Done ***");
+	return 0;
 }
@@ -0,0 +1,336 @@
+/* X11 latency injection proxy, to test xdpi over high-latency links.
+ * Licensed under the terms of the Mozilla Public License, version 2.
+ * See LICENSE.txt for details.
+ */
+
+/* The proxy listens as a new X display, and forwards all traffic to the
+ * target display, delaying it by half the requested round-trip time in
+ * each direction. When a client disconnects, the number of round trips
+ * (server replies following client requests) and the connection time are
+ * reported, so that the round trips actually done by a client can be checked.
+ *
+ * Example:
+ *
+ *	./xlag -d 50 -l 9 &
+ *	DISPLAY=:9 ./xdpi --fast
+ *
+ * The server must accept the connection from the proxy display, e.g. by
+ * running it with -ac, or by adding the cookie for :9 with xauth.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#define X_TCP_PORT 6000
+#define X_UNIX_PATH "/tmp/.X11-unix/X%d"
+#define MAX_CONN 64
+#define CHUNK 65536
+
+static void error(const char* msg)
+{
+	fprintf(stderr, "fatal: %s\n", msg);
+	exit(1);
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000.0 + ts.tv_nsec/1.0e6;
+}
+
+/* Data in flight, to be delivered at a given time */
+struct chunk
+{
+	struct chunk *next;
+	double deliver_at;
+	size_t len, off;
+	char data[];
+};
+
+/* A client connection and its connection to the server. Direction 0 goes
+ * from the client to the server, direction 1 from the server to the client.
+ */
+struct pair
+{
+	int fd[2]; /* client, server */
+	struct chunk *head[2], *tail[2];
+	int id;
+	int round_trips;
+	int last_dir;
+	double start;
+};
+
+static struct pair conns[MAX_CONN];
+static double half_delay = 5;
+
+static void close_pair(struct pair *p)
+{
+	fprintf(stderr, "xlag: connection %d closed after %d round trips, %.1fms\n",
+		p->id, p->round_trips, now_ms() - p->start);
+	for (int d = 0; d < 2; ++d) {
+		close(p->fd[d]);
+		while (p->head[d]) {
+			struct chunk *c = p->head[d];
+			p->head[d] = c->next;
+			free(c);
+		}
+	}
+	memset(p, 0, sizeof(*p));
+	p->fd[0] = p->fd[1] = -1;
+}
+
+/* Read from the given side, queueing the data for the other one.
+ * Returns -1 if the connection was closed
+ */
+static int forward_read(struct pair *p, int dir)
+{
+	struct chunk *c = malloc(sizeof(*c) + CHUNK);
+	if (!c) error("out of memory");
+	ssize_t n = read(p->fd[dir], c->data, CHUNK);
+	if (n <= 0) {
+		free(c);
+		return (n < 0 && errno == EINTR) ? 0 : -1;
+	}
+	c->next = NULL;
+	c->len = n;
+	c->off = 0;
+	c->deliver_at = now_ms() + half_delay;
+	if (p->tail[dir])
+		p->tail[dir]->next = c;
+	else
+		p->head[dir] = c;
+	p->tail[dir] = c;
+
+	/* A server reply after client requests completes a round trip */
+	if (dir == 1 && p->last_dir == 0)
+		++p->round_trips;
+	p->last_dir = dir;
+	return 0;
+}
+
+/* Write the data that is due in the given direction.
+ * Returns -1 if the connection was closed
+ */
+static int forward_write(struct pair *p, int dir, double now)
+{
+	int to = p->fd[!dir];
+	while (p->head[dir] && p->head[dir]->deliver_at <= now) {
+		struct chunk *c = p->head[dir];
+		ssize_t n = write(to, c->data + c->off, c->len - c->off);
+		if (n < 0)
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		c->off += n;
+		if (c->off < c->len)
+			return 0;
+		p->head[dir] = c->next;
+		if (!p->head[dir])
+			p->tail[dir] = NULL;
+		free(c);
+	}
+	return 0;
+}
+
+static int listen_unix(int display)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), X_UNIX_PATH, display);
+	unlink(addr.sun_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 16)) {
+		perror(addr.sun_path);
+		exit(1);
+	}
+	return fd;
+}
+
+static int listen_tcp(int display)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(X_TCP_PORT + display),
+		.sin_addr = { .s_addr = htonl(INADDR_LOOPBACK) }
+	};
+	int one = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd >= 0)
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 16)) {
+		perror("TCP listen");
+		exit(1);
+	}
+	return fd;
+}
+
+/* Connect to the target display: [unix]:N or host:N */
+static int connect_display(const char *display)
+{
+	const char *colon = strrchr(display, ':');
+	if (!colon)
+		return -1;
+	const int num = atoi(colon + 1);
+	const size_t host_len = colon - display;
+
+	if (!host_len || (host_len == 4 && !strncmp(display, "unix", 4))) {
+		struct sockaddr_un addr = { .sun_family = AF_UNIX };
+		snprintf(addr.sun_path, sizeof(addr.sun_path), X_UNIX_PATH, num);
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+			close(fd);
+			fd = -1;
+		}
+		return fd;
+	}
+
+	char host[256];
+	char port[16];
+	snprintf(host, sizeof(host), "%.*s", (int)host_len, display);
+	snprintf(port, sizeof(port), "%d", X_TCP_PORT + num);
+	struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+	struct addrinfo *res = NULL;
+	if (getaddrinfo(host, port, &hints, &res))
+		return -1;
+	int fd = -1;
+	for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static void usage(const char *progname)
+{
+	printf("Usage: %s [options]\n", progname);
+	puts("Options:");
+	puts("\t-d MS\t\tround-trip delay to add, in milliseconds (default: 10)");
+	puts("\t-l N\t\tdisplay number to listen as (default: 9)");
+	puts("\t-T\t\talso listen on TCP (localhost), not only on the Unix socket");
+	puts("\t-t DISPLAY\ttarget display (default: $DISPLAY)");
+	puts("\t-h\t\tshow this help");
+}
+
+int main(int argc, char *argv[])
+{
+	double delay = 10;
+	int display = 9;
+	int tcp = 0;
+	const char *target = getenv("DISPLAY");
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:l:t:Th")) != -1) {
+		switch (opt) {
+		case 'd': delay = atof(optarg); break;
+		case 'l': display = atoi(optarg); break;
+		case 't': target = optarg; break;
+		case 'T': tcp = 1; break;
+		case 'h': usage(argv[0]); return 0;
+		default: usage(argv[0]); return 2;
+		}
+	}
+	if (!target)
+		error("no target display");
+	half_delay = delay/2;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int listeners[2] = { listen_unix(display), tcp ? listen_tcp(display) : -1 };
+	const int nlisten = tcp ? 2 : 1;
+
+	for (int k = 0; k < MAX_CONN; ++k)
+		conns[k].fd[0] = conns[k].fd[1] = -1;
+
+	fprintf(stderr, "xlag: :%d -> %s, %gms round-trip delay\n", display, target, delay);
+
+	int next_id = 0;
+	struct pollfd fds[2 + 2*MAX_CONN];
+	for (;;) {
+		/* Wait for new data, or for the first data in flight to be due */
+		double now = now_ms();
+		double next = -1;
+		int nfds = 0;
+		for (int l = 0; l < nlisten; ++l)
+			fds[nfds++] = (struct pollfd){ .fd = listeners[l], .events = POLLIN };
+		for (int k = 0; k < MAX_CONN; ++k) {
+			struct pair *p = conns + k;
+			for (int d = 0; d < 2; ++d) {
+				/* Readable data from side d, writable pending data to side d */
+				short events = POLLIN;
+				const struct chunk *pending = p->head[!d];
+				if (pending && pending->deliver_at <= now)
+					events |= POLLOUT;
+				else if (pending && (next < 0 || pending->deliver_at < next))
+					next = pending->deliver_at;
+				fds[nfds++] = (struct pollfd){ .fd = p->fd[d], .events = events };
+			}
+		}
+
+		int timeout = next < 0 ? -1 : (int)(next - now) + 1;
+		if (poll(fds, nfds, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return 1;
+		}
+
+		for (int l = 0; l < nlisten; ++l) {
+			if (!(fds[l].revents & POLLIN))
+				continue;
+			int client = accept(listeners[l], NULL, NULL);
+			if (client < 0)
+				continue;
+			int server = connect_display(target);
+			int k = 0;
+			while (k < MAX_CONN && conns[k].fd[0] >= 0)
+				++k;
+			if (server < 0 || k == MAX_CONN) {
+				fprintf(stderr, "xlag: could not forward connection to %s\n", target);
+				close(client);
+				if (server >= 0)
+					close(server);
+				continue;
+			}
+			fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+			fcntl(server, F_SETFL, fcntl(server, F_GETFL) | O_NONBLOCK);
+			conns[k] = (struct pair){
+				.fd = { client, server },
+				.id = next_id++,
+				.last_dir = 1,
+				.start = now_ms()
+			};
+		}
+
+		now = now_ms();
+		for (int k = 0; k < MAX_CONN; ++k) {
+			struct pair *p = conns + k;
+			const struct pollfd *pfd = fds + nlisten + 2*k;
+			if (p->fd[0] < 0)
+				continue;
+			int ret = 0;
+			for (int d = 0; d < 2 && !ret; ++d) {
+				if (pfd[d].revents & (POLLIN | POLLHUP | POLLERR))
+					ret = forward_read(p, d);
+			}
+			for (int d = 0; d < 2 && !ret; ++d)
+				ret = forward_write(p, d, now);
+			if (ret)
+				close_pair(p);
+		}
+	}
+}